@@ -66,6 +66,10 @@ public:
         __atomic_exchange(&value,&v,&ret,__ATOMIC_SEQ_CST);
         return ret;
     }
+    // on failure, "expected" is updated with the current value
+    bool compare_exchange(T& expected, T desired) {
+        return __atomic_compare_exchange_n(&value,&expected,desired,false,__ATOMIC_SEQ_CST,__ATOMIC_SEQ_CST);
+    }
     void monitor_value() {
         monitor((uintptr_t)&value);
     }
@@ -115,6 +119,9 @@ public:
     inline void unlock() {}
 };
 
+// Not a lock: selects the lock-free Queue implementation (see queue.h)
+class LockFree {};
+
 extern void pause();
 
 class SpinLock {
@@ -0,0 +1,149 @@
+#include "console.h"
+#include "machine.h"
+#include "config.h"
+#include "idt.h"
+#include "smp.h"
+#include "libk.h"
+
+/* COM1 registers */
+constexpr uint32_t THR = 0x3F8;     // transmit holding
+constexpr uint32_t IER = 0x3F9;     // interrupt enable
+constexpr uint32_t IIR = 0x3FA;     // interrupt identification (read)
+constexpr uint32_t FCR = 0x3FA;     // FIFO control (write)
+constexpr uint32_t MCR = 0x3FC;     // modem control
+constexpr uint32_t LSR = 0x3FD;     // line status
+
+constexpr uint32_t LSR_THRE = 0x20;
+
+constexpr uint32_t UART_IRQ = 4;
+constexpr uint32_t UART_vector = 41;
+
+Console* console = nullptr;
+
+extern "C" void uartHandler_(void);
+
+// interrupts off on this core while the ring lock is held, the UART
+// interrupt takes the same lock
+struct InterruptGuard {
+    bool was;
+    InterruptGuard() : was((getFlags() & 0x200) != 0) {
+        cli();
+    }
+    ~InterruptGuard() {
+        if (was) sti();
+    }
+};
+
+Console::Console() : data(new char[CAPACITY]) {
+    // 16 byte transmit FIFO, if this is a 16550
+    outb(FCR, 0x07);
+    if ((inb(IIR) & 0xC0) == 0xC0) {
+        fifo_depth = 16;
+    }
+}
+
+void Console::init_interrupts() {
+    IDT::interrupt(UART_vector, (uint32_t)uartHandler_);
+
+    // IOAPIC redirection entry for the IRQ: edge triggered, active high,
+    // delivered to the bootstrap core
+    volatile uint32_t* ioregsel = (volatile uint32_t*) kConfig.ioAPIC;
+    volatile uint32_t* iowin = (volatile uint32_t*) (kConfig.ioAPIC + 0x10);
+    *ioregsel = 0x10 + 2 * UART_IRQ + 1;
+    *iowin = 0 << 24;
+    *ioregsel = 0x10 + 2 * UART_IRQ;
+    *iowin = UART_vector;
+
+    // OUT2 gates the UART's interrupt line, then ask for "transmitter empty"
+    outb(MCR, 0x0B);
+    outb(IER, 0x02);
+
+    InterruptGuard g{};
+    LockGuard lg{lock};
+    interrupts_on = true;
+    send();
+}
+
+void Console::send() {
+    while (used != 0 && (inb(LSR) & LSR_THRE)) {
+        uint32_t n = K::min(used, fifo_depth);
+        for (uint32_t i = 0; i < n; i++) {
+            outb(THR, data[head]);
+            head = (head + 1) % CAPACITY;
+        }
+        used -= n;
+    }
+}
+
+void Console::append(const char* buffer, uint32_t n) {
+    while (n > 0) {
+        if (used == CAPACITY) {
+            // full, wait for the UART ourselves
+            while (!(inb(LSR) & LSR_THRE)) {
+                asm volatile("pause");
+            }
+            send();
+            continue;
+        }
+        uint32_t tail = (head + used) % CAPACITY;
+        uint32_t m = K::min(n, CAPACITY - used, CAPACITY - tail);
+        memcpy(data + tail, buffer, m);
+        used += m;
+        buffer += m;
+        n -= m;
+    }
+    // start the transmitter if it is idle, the interrupt takes it from there
+    send();
+    if (!interrupts_on) {
+        while (used != 0) {
+            send();
+        }
+    }
+}
+
+void Console::put(char ch) {
+    InterruptGuard g{};
+    LockGuard lg{lock};
+    append(&ch, 1);
+}
+
+void Console::write(const char* buffer, uint32_t n) {
+    InterruptGuard g{};
+    LockGuard lg{lock};
+    append(buffer, n);
+}
+
+void Console::drain() {
+    InterruptGuard g{};
+    LockGuard lg{lock};
+    send();
+}
+
+void Console::flush() {
+    InterruptGuard g{};
+    LockGuard lg{lock};
+    while (used != 0) {
+        send();
+    }
+    while (!(inb(LSR) & 0x40)) {
+        // transmitter not completely empty yet
+        asm volatile("pause");
+    }
+}
+
+void Console::panic() {
+    cli();
+    // the core holding it may have stopped for good
+    lock.unlock();
+    // the interrupt may never come, writers send their bytes themselves
+    interrupts_on = false;
+}
+
+extern "C" void uartHandler() {
+    // reading IIR acknowledges the "transmitter empty" interrupt
+    inb(IIR);
+    if (console != nullptr) {
+        console->drain();
+    }
+    SMP::eoi();
+}
@@ -0,0 +1,52 @@
+#ifndef _CONSOLE_H_
+#define _CONSOLE_H_
+
+#include "stdint.h"
+#include "io.h"
+#include "atomic.h"
+
+// Buffered console output on the 8250 (COM1).
+//
+// Writers copy into a transmit ring and return; the UART's "transmit
+// holding register empty" interrupt (IRQ 4 through the IOAPIC) drains it.
+// The timer also kicks the drain in case an interrupt got lost. Only when
+// the ring is full does a writer fall back to polling the UART.
+class Console : public OutputStream<char> {
+    static constexpr uint32_t CAPACITY = 16 * 1024;
+
+    SpinLock lock{};
+    char* const data;
+    uint32_t head = 0;          // next byte to send
+    uint32_t used = 0;          // bytes waiting in the ring
+    uint32_t fifo_depth = 1;    // bytes the UART takes at once when it is empty
+    bool interrupts_on = false; // until then, writers wait for their bytes to go out
+
+    // moves bytes from the ring to the UART while it has room, lock held
+    void send();
+
+    // adds n bytes to the ring, lock held and interrupts disabled
+    void append(const char* buffer, uint32_t n);
+
+public:
+    Console();
+    Console(const Console&) = delete;
+
+    // routes the UART interrupt to the bootstrap core, call once
+    void init_interrupts();
+
+    virtual void put(char ch) override;
+    virtual void write(const char* buffer, uint32_t n) override;
+
+    // called from the UART interrupt and the timer
+    void drain();
+
+    // waits until everything has gone out, used at shutdown and panic
+    virtual void flush() override;
+
+    // drops the lock and goes back to polling the UART
+    virtual void panic() override;
+};
+
+extern Console* console;
+
+#endif
@@ -6,6 +6,7 @@
 #include "kernel.h"
 #include "atomic.h"
 #include "heap.h"
+#include "sched_stats.h"
 
 OutputStream<char> *Debug::sink = 0;
 bool Debug::debugAll = false;
@@ -18,10 +19,34 @@ void Debug::init(OutputStream<char> *sink) {
 
 static SpinLock lock{};
 
+// collects what vsnprintf produces so the sink gets it in a few writes
+// instead of one put per character
+class Chunks : public OutputStream<char> {
+    OutputStream<char>& sink;
+    char data[128];
+    uint32_t n = 0;
+public:
+    explicit Chunks(OutputStream<char>& sink) : sink(sink) {}
+
+    virtual void put(char ch) override {
+        if (n == sizeof(data)) {
+            send();
+        }
+        data[n++] = ch;
+    }
+
+    void send() {
+        sink.write(data, n);
+        n = 0;
+    }
+};
+
 void Debug::vprintf(const char* fmt, va_list ap) {
     if (sink) {
         lock.lock();
-        K::vsnprintf(*sink,1000,fmt,ap);
+        Chunks out{*sink};
+        K::vsnprintf(out,1000,fmt,ap);
+        out.send();
         lock.unlock();
     }
 }
@@ -37,12 +62,16 @@ static Atomic<bool> showed_checks { false };
 
 void Debug::shutdown() {
     Debug::printf("leaks %d\n", gheith::heap_count);
+    SchedStats::dump();
     if (!showed_checks.exchange(true)) {
         if (checks.get() > 0) {
             printf("passed %d checks\n",checks.get());
         }
     }
     printf("shutdown\n",SMP::me());
+    if (sink) {
+        sink->flush();
+    }
     shutdown_called = true;
     while (true) {
         outb(0xf4,0x00);
@@ -54,8 +83,14 @@ void Debug::shutdown() {
 
 void Debug::vpanic(const char* fmt, va_list ap) {
     lock.unlock(); // things are going bad, force unlock
+    if (sink) {
+        sink->panic();
+    }
     vprintf(fmt,ap);
     printf("| processor %d halting\n",SMP::me());
+    if (sink) {
+        sink->flush();
+    }
     shutdown_called = true;
     while (true) {
         outb(0xf4,0x00);
@@ -3,30 +3,35 @@
 #include "debug.h"
 #include "config.h"
 #include "kernel.h"
+#include "physmem.h"
+#include "vmm.h"
+#include "libk.h"
 
-uint32_t ELF::valid_load(Node* file) {
+// reads and validates the headers of "file", null if it can't be loaded
+static Shared<ElfImage> parse(Node* file) {
     ElfHeader header;
     uint32_t file_size = file->size_in_bytes();
     if (file_size < sizeof(header)) {
-        return -1;
+        return {};
     }
     file->read(0, header);
 
     // check if this file is an elf file
     if (header.magic0 != 0x7f || header.magic1 != 'E' || header.magic2 != 'L' || header.magic3 != 'F' || header.cls != 1 || header.machine != 3 || header.version != 1) {
-        return -1;
+        return {};
     }
 
     // check if the entry point is outside the user range
     if (header.entry < 0x80000000 || header.entry >= 0xF0001000) {
-        return -1;
+        return {};
     }
 
     if (header.phoff > file_size || file_size < header.phnum * header.phentsize) {
-        return -1;
+        return {};
     }
 
     ProgramHeader* p_headers = new ProgramHeader[header.phnum];
+    uint32_t nsegments = 0;
     bool valid_entry = false;
     for (uint32_t i = 0; i < header.phnum; i++) {
         file->read(header.phoff + header.phentsize * i, p_headers[i]);
@@ -35,11 +40,12 @@ uint32_t ELF::valid_load(Node* file) {
         if (p_headers[i].type != 1) {
             continue;
         }
+        nsegments++;
 
         // check if this elf file tries to load a program outside the user range
         if (p_headers[i].vaddr < 0x80000000 || p_headers[i].vaddr + p_headers[i].memsz >= 0xF0001000 || p_headers[i].vaddr + p_headers[i].memsz - 1 < p_headers[i].vaddr - 1) {
             delete[] p_headers;
-            return -1;
+            return {};
         }
 
         if (header.entry >= p_headers[i].vaddr && header.entry < p_headers[i].vaddr + p_headers[i].memsz) {
@@ -50,40 +56,189 @@ uint32_t ELF::valid_load(Node* file) {
     // entry point cannot be in undefined memory
     if (!valid_entry) {
         delete[] p_headers;
-        return -1;
+        return {};
     }
 
+    // keep only what load needs
+    auto image = Shared<ElfImage>::make(file->number, header.entry, nsegments);
+    uint32_t j = 0;
+    for (uint32_t i = 0; i < header.phnum; i++) {
+        if (p_headers[i].type == 1) {
+            image->segments[j++].header = p_headers[i];
+        }
+    }
     delete[] p_headers;
 
-    return 1;
+    // read only segments can be shared, unless another segment needs
+    // some of the same pages
+    for (uint32_t i = 0; i < nsegments; i++) {
+        ElfSegment& segment = image->segments[i];
+        if ((segment.header.flags & 2) != 0 || segment.header.memsz == 0) {
+            continue;
+        }
+        bool alone = true;
+        for (uint32_t k = 0; k < nsegments; k++) {
+            ElfSegment& other = image->segments[k];
+            if (k == i || other.header.memsz == 0) {
+                continue;
+            }
+            uint32_t start = segment.first_page();
+            uint32_t end = start + segment.pages() * 4096;
+            uint32_t other_start = other.first_page();
+            uint32_t other_end = other_start + other.pages() * 4096;
+            if (start < other_end && other_start < end) {
+                alone = false;
+                break;
+            }
+        }
+        if (alone) {
+            segment.shared = true;
+            segment.frames = new uint32_t[segment.pages()];
+            for (uint32_t k = 0; k < segment.pages(); k++) {
+                segment.frames[k] = 0;
+            }
+        }
+    }
+
+    return image;
 }
 
-uint32_t ELF::load(Node* file) {
-    ElfHeader header;
-    file->read(0, header);
+ElfSegment::~ElfSegment() {
+    if (frames != nullptr) {
+        for (uint32_t k = 0; k < pages(); k++) {
+            if (frames[k] != 0) {
+                PhysMem::dealloc_frame(frames[k]);
+            }
+        }
+        delete[] frames;
+    }
+}
 
-    // valid_load should already be called, meaning this should be loading something that is VALID
+// protects the frames of all shared segments
+static SpinLock frames_lock{};
+
+// the frame holding page k of a shared segment, read from the file the
+// first time anyone needs it
+static uint32_t shared_frame(ElfSegment& segment, Node* file, uint32_t k) {
+    frames_lock.lock();
+    uint32_t frame = segment.frames[k];
+    frames_lock.unlock();
+    if (frame != 0) {
+        return frame;
+    }
 
-    ProgramHeader* p_headers = new ProgramHeader[header.phnum];
-    for (uint32_t i = 0; i < header.phnum; i++) {
-        file->read(header.phoff + header.phentsize * i, p_headers[i]);
+    // frames are identity mapped, fill it in place
+    frame = PhysMem::alloc_frame();
+    ProgramHeader& header = segment.header;
+    uint32_t page = segment.first_page() + k * 4096;
+    uint32_t from = (page > header.vaddr) ? page : header.vaddr;
+    uint32_t to = K::min(page + 4096, header.vaddr + header.filesz);
+    if (from < to) {
+        file->read_all(header.offset + (from - header.vaddr), to - from, (char*)(frame + (from - page)));
+    }
+
+    frames_lock.lock();
+    if (segment.frames[k] == 0) {
+        segment.frames[k] = frame;
+    } else {
+        // someone else got there first
+        PhysMem::dealloc_frame(frame);
+        frame = segment.frames[k];
+    }
+    frames_lock.unlock();
+    return frame;
+}
+
+// maps the pages of a shared segment read only into the current address space
+static void map_shared(ElfSegment& segment, Node* file) {
+    uint32_t* page_directory = (uint32_t*)(getCR3() & 0xFFFFF000);
+    for (uint32_t k = 0; k < segment.pages(); k++) {
+        uint32_t va = segment.first_page() + k * 4096;
+        uint32_t pdi = va >> 22;
+        if ((page_directory[pdi] & 1) == 0) {
+            page_directory[pdi] = PhysMem::alloc_frame() | 0x7;
+        }
+        uint32_t* page_table = (uint32_t*)(page_directory[pdi] & 0xFFFFF000);
+        page_table[(va >> 12) & 0x3FF] = shared_frame(segment, file, k) | 0x105 | VMM::SHARED;
+    }
+}
+
+// Recently used images, replaced round robin. The file system is read only,
+// so an entry never goes stale
+constexpr uint32_t IMAGE_CACHE_SIZE = 16;
+static SpinLock image_cache_lock{};
+static Shared<ElfImage>* image_cache = nullptr;
+static uint32_t image_cache_next = 0;
+
+// the cached image of "file", null if there is none. image_cache_lock held
+static Shared<ElfImage> cached_image(Node* file) {
+    if (image_cache == nullptr) {
+        image_cache = new Shared<ElfImage>[IMAGE_CACHE_SIZE];
+    }
+    for (uint32_t i = 0; i < IMAGE_CACHE_SIZE; i++) {
+        if (!image_cache[i].is_null() && image_cache[i]->inode == file->number) {
+            return image_cache[i];
+        }
+    }
+    return Shared<ElfImage>{};
+}
+
+Shared<ElfImage> ELF::image(Node* file) {
+    image_cache_lock.lock();
+    Shared<ElfImage> hit = cached_image(file);
+    image_cache_lock.unlock();
+    if (!hit.is_null()) {
+        return hit;
+    }
+
+    // parse without the lock, it reads the disk
+    Shared<ElfImage> image = parse(file);
+    if (image.is_null()) {
+        return image;
+    }
+
+    image_cache_lock.lock();
+    // another core may have parsed the same file meanwhile. Everyone has to
+    // use the same image, its frames are the shared text
+    hit = cached_image(file);
+    if (hit.is_null()) {
+        image_cache[image_cache_next] = image;
+        image_cache_next = (image_cache_next + 1) % IMAGE_CACHE_SIZE;
+    } else {
+        image = hit;
     }
+    image_cache_lock.unlock();
+
+    return image;
+}
+
+uint32_t ELF::valid_load(Node* file) {
+    return image(file).is_null() ? -1 : 1;
+}
+
+uint32_t ELF::load(Node* file) {
+    // valid_load should already be called, so this is normally a cache hit
+    Shared<ElfImage> image = ELF::image(file);
 
     PCB* pcb = active_pcbs.mine();
-    for (uint32_t i = 0; i < header.phnum; i++) {
-        // check if this program header is a load operation. if not, skip
-        if (p_headers[i].type != 1) {
+    for (uint32_t i = 0; i < image->nsegments; i++) {
+        ElfSegment& segment = image->segments[i];
+        if (segment.shared) {
+            pcb->queue->add_vme(new VME(segment.first_page(), segment.pages() * 4096, false));
+            map_shared(segment, file);
             continue;
         }
 
-        uint32_t aligned_vaddr = (p_headers[i].vaddr >> 12) << 12;
-        uint32_t aligned_vaddr_end = (((p_headers[i].vaddr + p_headers[i].memsz - 1) >> 12) + 1) << 12;
+        ProgramHeader& header = segment.header;
+        uint32_t aligned_vaddr = (header.vaddr >> 12) << 12;
+        uint32_t aligned_vaddr_end = (((header.vaddr + header.memsz - 1) >> 12) + 1) << 12;
         uint32_t aligned_memsz = aligned_vaddr_end - aligned_vaddr;
         pcb->queue->add_vme(new VME(aligned_vaddr, aligned_memsz));
-        file->read_all(p_headers[i].offset, p_headers[i].filesz, (char*)p_headers[i].vaddr);
+        file->read_all(header.offset, header.filesz, (char*)header.vaddr);
     }
 
-    delete[] p_headers;
+    // the process holds on to the image while it maps its frames
+    pcb->image = image;
 
-    return header.entry;
-}
\ No newline at end of file
+    return image->entry;
+}
@@ -3,12 +3,19 @@
 
 #include "stdint.h"
 #include "ext2.h"
+#include "shared.h"
+
+struct ElfImage;
 
 class ELF {
 public:
     static uint32_t load(Node* file);
 
     static uint32_t valid_load(Node* file);
+
+    // the validated image of "file", null if it is not a loadable ELF file.
+    // Images are cached by i-number, so a hit costs no disk reads
+    static Shared<ElfImage> image(Node* file);
 };
 
 struct ElfHeader {
@@ -50,4 +57,42 @@ struct ProgramHeader {
     uint32_t align;   /* alignment */
 } __attribute__((packed));
 
+// A loadable segment. Read only segments that don't share a page with
+// another segment are backed by frames owned by the image and mapped into
+// every process running the program; the rest are copied per process
+struct ElfSegment {
+    ProgramHeader header;
+    bool shared;
+    uint32_t* frames;                   // one per page when shared, 0 until first loaded
+
+    ElfSegment() : header(), shared(false), frames(nullptr) {}
+    ElfSegment(const ElfSegment&) = delete;
+
+    ~ElfSegment();
+
+    uint32_t first_page() const {
+        return header.vaddr & 0xFFFFF000;
+    }
+
+    uint32_t pages() const {
+        return (((header.vaddr + header.memsz - 1) >> 12) + 1) - (header.vaddr >> 12);
+    }
+};
+
+// What loading needs to know about an executable, parsed and validated once
+struct ElfImage {
+    const uint32_t inode;
+    const uint32_t entry;
+    const uint32_t nsegments;
+    ElfSegment* const segments;         // the loadable ones
+
+    ElfImage(uint32_t inode, uint32_t entry, uint32_t nsegments) : inode(inode), entry(entry),
+        nsegments(nsegments), segments(new ElfSegment[nsegments]) {}
+    ElfImage(const ElfImage&) = delete;
+
+    ~ElfImage() {
+        delete[] segments;
+    }
+};
+
 #endif
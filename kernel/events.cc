@@ -1,8 +1,11 @@
 #include "events.h"
 #include "smp.h"
+#include "config.h"
+#include "sched_stats.h"
 
     namespace impl {
-        Queue<Event, SpinLock> ready_queue{};
+        RunQueue ready_queue{};
+        PerCPU<RunQueue> core_queues;
         PerCPU<Event*> last_event;
 
         struct PQEntry {
@@ -54,6 +57,52 @@
         void timed(const uint32_t at, Event* e) {
             pq.add(at, e);
         }
+
+        // only migrate work away from a core that has at least this many
+        // events waiting, otherwise its caches are worth more than our idle time
+        constexpr uint32_t MIGRATE_THRESHOLD = 2;
+
+        // take an event from the most backed up core that allows us to run it
+        Event* steal() {
+            auto me = SMP::me();
+            uint32_t victim = me;
+            uint32_t most = MIGRATE_THRESHOLD - 1;
+            for (uint32_t id = 0; id < kConfig.totalProcs; id++) {
+                if (id == me) continue;
+                auto n = core_queues.forCPU(id).length();
+                if (n > most) {
+                    most = n;
+                    victim = id;
+                }
+            }
+            if (victim == me) return nullptr;
+            return core_queues.forCPU(victim).remove_if([me](Event* e) {
+                return (e->affinity & (1 << me)) != 0;
+            });
+        }
+
+        // a core's own queue goes first, but every this many picks the global
+        // queue does. Preempted processes always requeue locally, so new
+        // processes, wakeups and timers would starve behind them otherwise
+        constexpr uint32_t GLOBAL_EVERY = 4;
+        PerCPU<uint32_t> local_picks;
+
+        Event* next_event() {
+            Event* e = nullptr;
+            if (local_picks.mine() >= GLOBAL_EVERY) {
+                local_picks.mine() = 0;
+                e = ready_queue.remove();
+            }
+            if (e == nullptr) {
+                e = core_queues.mine().remove();
+                if (e != nullptr) {
+                    local_picks.mine() += 1;
+                }
+            }
+            if (e == nullptr) e = ready_queue.remove();
+            if (e == nullptr) e = steal();
+            return e;
+        }
     }
 
     void event_loop() {
@@ -68,13 +117,22 @@
                 if (e == nullptr) break;
                 impl::ready_queue.add(e);
             }
-            auto e = impl::ready_queue.remove();
+            auto e = impl::next_event();
             if (e == nullptr) {
                 pause();
-            } else {
+                continue;
+            }
+            SchedStats::waited(rdtsc() - e->queued_at);
+            if (e->owned) {
+                // doit might never return (e.g. it resumes a user process),
+                // the next pass through the loop cleans up after it
                 impl::last_event.mine() = e;
                 e->doit();
+                impl::last_event.mine() = nullptr;
                 delete e;
+            } else {
+                // embedded in something else (e.g. a PCB), not ours to free
+                e->doit();
             }
         }
     }
@@ -6,6 +6,7 @@
 #include "shared.h"
 
 #include <coroutine>
+#include <type_traits>
 
 // Implementation details, we use a namespace to protect against
 // accidental direct use in test cases
@@ -15,10 +16,29 @@ namespace impl {
 
     struct Event {
         Event* next = nullptr;
+        uint32_t affinity = ~uint32_t(0);    // cores allowed to run this event, one bit per core
+        bool owned = true;                   // heap allocated, the event loop deletes it once it runs
+        uint64_t queued_at = 0;              // TSC when it last became runnable
         virtual void doit() = 0;
         virtual ~Event() {}
     };
 
+    // resumes a suspended coroutine. Lives in the awaiter, so waiting
+    // doesn't allocate
+    struct ResumeCoroutine: public Event {
+        std::coroutine_handle<void> handle{};
+        ResumeCoroutine() {
+            owned = false;
+        }
+        void doit() override {
+            handle.resume();
+        }
+    };
+
+    // events are scheduled as they are, any other work gets wrapped in one
+    template <typename Work>
+    concept NotAnEvent = !std::is_convertible_v<Work, Event*>;
+
     template <typename Work>
     struct EventWithWork: public Event {
         const Work work;
@@ -28,7 +48,43 @@ namespace impl {
         }
     };
 
-    extern Queue<Event, SpinLock> ready_queue;
+    // A queue of runnable events that remembers when each one was queued,
+    // so the event loop can tell how long it waited
+    class RunQueue {
+        Queue<Event, LockFree> queue{};
+    public:
+        void add(Event* e) {
+            e->queued_at = rdtsc();
+            queue.add(e);
+        }
+
+        void add_all(Event* list) {
+            auto now = rdtsc();
+            for (auto it = list; it != nullptr; it = it->next) {
+                it->queued_at = now;
+            }
+            queue.add_all(list);
+        }
+
+        Event* remove() {
+            return queue.remove();
+        }
+
+        template <typename Pred>
+        Event* remove_if(const Pred& pred) {
+            return queue.remove_if(pred);
+        }
+
+        uint32_t length() {
+            return queue.length();
+        }
+    };
+
+    extern RunQueue ready_queue;
+
+    // work that prefers a particular core (warm caches and TLB), other cores
+    // only steal from it when the owner falls behind
+    extern PerCPU<RunQueue> core_queues;
 
     template <typename Work>
     void run_at(const uint32_t at, const Work& work) {
@@ -62,6 +118,15 @@ inline void go(const Work& work, uint32_t const delay=0) {
     }
 }
 
+// Schedules some work on the given core. Idle cores in "affinity" may
+// steal it if that core has a backlog
+template <typename Work>
+inline void go_on(uint32_t core, uint32_t affinity, const Work& work) {
+    auto e = new impl::EventWithWork(work);
+    e->affinity = affinity;
+    impl::core_queues.forCPU(core).add(e);
+}
+
 // Called in "init.cc" when a core is idle. Beware of stack overflow
 extern void event_loop();
 
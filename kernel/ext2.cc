@@ -34,6 +34,38 @@ Ext2::Ext2(Ide* ide): ide(ide), root() {
 }
 
 Node* Ext2::get_node(uint32_t number) {
+    ASSERT(number > 0);
+    ASSERT(number <= numberOfNodes);
+    Node** bucket = &nodes[number % NODE_BUCKETS];
+
+    nodes_lock.lock();
+    for (Node* it = *bucket; it != nullptr; it = it->next_cached) {
+        if (it->number == number) {
+            nodes_lock.unlock();
+            return it;
+        }
+    }
+    nodes_lock.unlock();
+
+    // read it without holding the lock, someone may beat us to it
+    Node* out = read_node(number);
+
+    nodes_lock.lock();
+    for (Node* it = *bucket; it != nullptr; it = it->next_cached) {
+        if (it->number == number) {
+            nodes_lock.unlock();
+            delete out;
+            return it;
+        }
+    }
+    out->next_cached = *bucket;
+    *bucket = out;
+    node_count.fetch_add(1);
+    nodes_lock.unlock();
+    return out;
+}
+
+Node* Ext2::read_node(uint32_t number) {
     ASSERT(number > 0);
     ASSERT(number <= numberOfNodes);
     auto index = number - 1;
@@ -115,6 +115,7 @@ public:
     // i-number of this node
     const uint32_t number;
     NodeData data;
+    Node* next_cached = nullptr;        // Ext2's node cache
 
     Node(Ide* ide, uint32_t number, uint32_t block_size) : BlockIO(block_size), ide(ide), number(number) {
 
@@ -213,6 +214,15 @@ private:
     uint32_t nGroups;
     uint32_t *iNodeTables;
     uint32_t iNodesPerGroup;
+
+    // every node handed out, by i-number. The file system is read only,
+    // so one Node per i-node can be shared by everyone and lives forever
+    static constexpr uint32_t NODE_BUCKETS = 256;
+    SpinLock nodes_lock{};
+    Node* nodes[NODE_BUCKETS]{};
+    Atomic<uint32_t> node_count{0};
+
+    Node* read_node(uint32_t number);
 public:
     // Mount an existing file system residing on the given device
     // Panics if the file system is invalid
@@ -231,9 +241,15 @@ public:
         return iNodeSize;
     }
 
-    // Returns the node with the given i-number
+    // Returns the node with the given i-number, the same Node for every
+    // call. The caller doesn't own it
     Node* get_node(uint32_t number);
 
+    // how many distinct nodes have been read so far
+    uint32_t cached_nodes() {
+        return node_count;
+    }
+
     // If the given node is a directory, return a reference to the
     // node linked to that name in the directory.
     //
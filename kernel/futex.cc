@@ -0,0 +1,117 @@
+#include "futex.h"
+#include "atomic.h"
+
+using namespace impl;
+
+namespace Futex {
+
+    struct Waiter {
+        Waiter* next;
+        uint32_t key;
+        Event* event;
+    };
+
+    // a lock and a FIFO list of waiters, shared by all the keys that hash here
+    struct Bucket {
+        SpinLock lock{};
+        Waiter* first = nullptr;
+        Waiter* last = nullptr;
+    };
+
+    constexpr uint32_t BUCKETS = 64;
+    static Bucket buckets[BUCKETS];
+
+    static Bucket& bucket(uint32_t key) {
+        // words are aligned, mix in the page number so neighbouring pages spread out
+        uint32_t h = (key >> 2) ^ (key >> 12);
+        return buckets[h % BUCKETS];
+    }
+
+    bool wait(uint32_t key, volatile uint32_t* word, uint32_t expected, Event* e) {
+        auto waiter = new Waiter{nullptr, key, e};
+
+        Bucket& b = bucket(key);
+        b.lock.lock();
+        if (*word != expected) {
+            b.lock.unlock();
+            delete waiter;
+            return false;
+        }
+        if (b.first == nullptr) {
+            b.first = waiter;
+        } else {
+            b.last->next = waiter;
+        }
+        b.last = waiter;
+        b.lock.unlock();
+        return true;
+    }
+
+    uint32_t wake(uint32_t key, uint32_t n) {
+        Waiter* woken = nullptr;
+        uint32_t count = 0;
+
+        Bucket& b = bucket(key);
+        b.lock.lock();
+        Waiter* prev = nullptr;
+        Waiter* it = b.first;
+        while (it != nullptr && count < n) {
+            Waiter* next = it->next;
+            if (it->key == key) {
+                // unlink, collect in reverse
+                if (prev == nullptr) {
+                    b.first = next;
+                } else {
+                    prev->next = next;
+                }
+                if (b.last == it) {
+                    b.last = prev;
+                }
+                it->next = woken;
+                woken = it;
+                count++;
+            } else {
+                prev = it;
+            }
+            it = next;
+        }
+        b.lock.unlock();
+
+        // chain the events in waiting order and make them runnable together
+        Event* events = nullptr;
+        while (woken != nullptr) {
+            Waiter* next = woken->next;
+            woken->event->next = events;
+            events = woken->event;
+            delete woken;
+            woken = next;
+        }
+        ready_queue.add_all(events);
+
+        return count;
+    }
+
+    bool cancel(uint32_t key, Event* e) {
+        Bucket& b = bucket(key);
+        b.lock.lock();
+        Waiter* prev = nullptr;
+        for (Waiter* it = b.first; it != nullptr; it = it->next) {
+            if (it->key == key && it->event == e) {
+                if (prev == nullptr) {
+                    b.first = it->next;
+                } else {
+                    prev->next = it->next;
+                }
+                if (b.last == it) {
+                    b.last = prev;
+                }
+                b.lock.unlock();
+                delete it;
+                return true;
+            }
+            prev = it;
+        }
+        b.lock.unlock();
+        return false;
+    }
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "stdint.h"
+#include "events.h"
+
+// Waiting on a word of memory, the kernel half of user space locks and
+// semaphores. User code changes the word with atomic instructions and only
+// calls in to sleep while the word holds a value, or to wake sleepers after
+// changing it.
+//
+// A word is named by its physical address, so every address space that maps
+// it agrees on the key. Waiters live in a hashed table of FIFO queues
+// rather than Semaphores: a key has no kernel object to hold one, and the
+// word has to be checked under the same lock that wake takes, which a
+// Semaphore's count can't express.
+namespace Futex {
+
+    // Schedules e once someone wakes "key", unless *word != expected. The
+    // check and the enqueue are atomic with respect to wake, so a wake that
+    // follows a change of the word can't be missed. Returns false (and drops
+    // e) if the word had already changed.
+    //
+    // The caller must make sure that reading *word can't fault.
+    extern bool wait(uint32_t key, volatile uint32_t* word, uint32_t expected, impl::Event* e);
+
+    // Wakes up to n waiters on "key" in the order they started waiting,
+    // returns how many woke up
+    extern uint32_t wake(uint32_t key, uint32_t n);
+
+    // Takes e out of the waiters on "key" without scheduling it, false if
+    // it isn't waiting there (a wake got to it first)
+    extern bool cancel(uint32_t key, impl::Event* e);
+}
@@ -33,7 +33,7 @@ public:
     // Schedules work to run when the value is ready (set has been called)
     // "work" must be a callable object with signature:
     //      void(T)
-    template <typename Work>
+    template <impl::NotAnEvent Work>
     void get(const Work& work) {
         state->sem.down([work, state=state] {
             state->sem.up();
@@ -41,6 +41,29 @@ public:
         });
     }
 
+    // Allocation free version of get(work): schedules "e" when the value is
+    // ready. When it runs, "e" must call take() to pass the wakeup on to
+    // other waiters
+    void get(impl::Event* e) {
+        state->sem.down(e);
+    }
+
+    // takes back a get(e) that is still waiting, false if the value was
+    // already handed to e
+    bool cancel(impl::Event* e) {
+        return state->sem.cancel(e);
+    }
+
+    T take() {
+        state->sem.up();
+        return state->value;
+    }
+
+    // the value once is_set(), without waiting or passing a wakeup on
+    T peek() {
+        return state->value;
+    }
+
     bool is_set() {
         return state->sem.count == 1;
     }
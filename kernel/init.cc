@@ -3,6 +3,8 @@
 #include "debug.h"
 #include "config.h"
 #include "u8250.h"
+#include "console.h"
+#include "membench.h"
 #include "smp.h"
 #include "machine.h"
 #include "kernel.h"
@@ -93,9 +95,14 @@ extern "C" void kernelInit(void) {
         /* initialize the heap */
         heapInit((void*)HEAP_START,HEAP_SIZE);
 
-        /* switch to dynamically allocated UART */
-        Debug::init(new U8250);
-        Debug::printf("| switched to new UART\n");
+        /* switch to the buffered console */
+        console = new Console();
+        Debug::init(console);
+        Debug::printf("| switched to buffered console\n");
+
+#ifdef MEMBENCH
+        membench();
+#endif
 
         /* running global constructors */
         CRT::init();
@@ -117,6 +124,9 @@ extern "C" void kernelInit(void) {
         IDT::init();
         Pit::calibrate(1000);
 
+        /* console output is drained by the UART interrupt from now on */
+        console->init_interrupts();
+
         SMP::running.fetch_add(1);
 
         // The reset EIP has to be
@@ -148,6 +158,7 @@ extern "C" void kernelInit(void) {
     tss[id].ss0 = kernelSS;
     ltr(tssDescriptorBase + id * 8);
     tss[id].esp0 = pickKernelStack();
+    SYS::per_core_init(tss[id].esp0);
 
     Debug::printf("| %d enabling interrupts, I'm scared\n",id);
     sti();
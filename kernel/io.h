@@ -1,9 +1,25 @@
 #ifndef _IO_H_
 #define _IO_H_
 
+#include "stdint.h"
+
 template<typename T> class OutputStream {
 public:
     virtual void put(T v) = 0;
+
+    // puts n values, all at once if the stream can
+    virtual void write(const T* buffer, uint32_t n) {
+        for (uint32_t i = 0; i < n; i++) {
+            put(buffer[i]);
+        }
+    }
+
+    // waits until everything that was put has been delivered
+    virtual void flush() {}
+
+    // the kernel is going down: stop waiting for whatever another (maybe
+    // halted) core holds, so the panic message gets out
+    virtual void panic() {}
 };
 
 template<typename T> class InputStream {
@@ -34,7 +34,13 @@ Node* getDir(Ext2* fs, Node* node, const char* name) {
 
 Ext2* fs;
 PerCPU<PCB*> active_pcbs;
+Atomic<uint32_t> PCB::next_pid{1};
+Atomic<uint32_t> PCB::live{0};
+SpinLock PCB::registry_lock{};
+PCB* PCB::registry[PCB::REGISTRY_BUCKETS];
 PerCPU<bool> interrupts;
+PerCPU<bool> in_process;
+PerCPU<uint32_t> slice_left;
 
 Future<int> kernelMain(void) {
     auto d = new Ide(1);
@@ -45,7 +51,11 @@ Future<int> kernelMain(void) {
     auto init = getFile(fs,sbin,"init");
 
     active_pcbs.mine() = new PCB(getCR3() & 0xFFFFF000);
+    // init has no parent to reap it, like an orphan
+    active_pcbs.mine()->release();
     active_pcbs.mine()->init_file_descriptor();
+    slice_left.mine() = active_pcbs.mine()->quantum;
+    in_process.mine() = true;
     
     Debug::printf("loading init\n");
     uint32_t e = ELF::load(init);
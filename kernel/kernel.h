@@ -14,4 +14,11 @@ extern PerCPU<PCB*> active_pcbs;
 
 extern PerCPU<bool> interrupts;
 
+// the core works for active_pcbs.mine(), in user mode or in the kernel on
+// its behalf. False in the event loop, where active_pcbs can be stale
+extern PerCPU<bool> in_process;
+
+// jiffies left in the time slice of the process running on each core
+extern PerCPU<uint32_t> slice_left;
+
 #endif
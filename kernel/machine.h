@@ -22,11 +22,13 @@ extern "C" void pageFaultHandler_(void);
 
 extern "C" void* memcpy(void *dest, const void* src, size_t n);
 extern "C" void* bzero(void *dest, size_t n);
+extern "C" void* memset(void *dest, int value, size_t n);
 
 extern "C" void sti();
 extern "C" void cli();
 extern "C" uint32_t getCR3();
 extern "C" uint32_t getFlags();
+extern "C" uint64_t rdtsc();
 extern "C" void monitor(uintptr_t);
 extern "C" void mwait();
 
@@ -50,8 +52,11 @@ extern "C" void ltr(uint32_t);
 
 extern uint32_t tssDescriptorBase;
 extern uint32_t kernelSS;
+extern uint32_t sysenterCS;
 
 extern "C" void sysHandler_(void);
+extern "C" void sysenterHandler_(void);
+extern "C" void killHandler_(void);
 
 
 #endif
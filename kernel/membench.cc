@@ -0,0 +1,45 @@
+#include "membench.h"
+
+#ifdef MEMBENCH
+
+#include "stdint.h"
+#include "machine.h"
+#include "debug.h"
+
+constexpr uint32_t SIZE = 64 * 1024;
+constexpr uint32_t ROUNDS = 32;
+
+static char src[SIZE];
+static char dest[SIZE + 4];
+
+// the routines as they used to be, one byte per iteration
+static void byte_copy(volatile char* d, const volatile char* s, uint32_t n) {
+    for (uint32_t i = 0; i < n; i++) d[i] = s[i];
+}
+
+static void byte_fill(volatile char* d, char v, uint32_t n) {
+    for (uint32_t i = 0; i < n; i++) d[i] = v;
+}
+
+template <typename Work>
+static void measure(const char* what, const Work& work) {
+    work();  // warm up
+    uint64_t start = rdtsc();
+    for (uint32_t i = 0; i < ROUNDS; i++) {
+        work();
+    }
+    uint64_t cycles = rdtsc() - start;
+    uint32_t per_kcycle = (uint32_t)((uint64_t(SIZE) * ROUNDS * 1000) / (cycles == 0 ? 1 : cycles));
+    Debug::printf("| membench %s: %d bytes per 1000 cycles\n", what, per_kcycle);
+}
+
+void membench() {
+    measure("byte copy", [] { byte_copy(dest, src, SIZE); });
+    measure("memcpy", [] { memcpy(dest, src, SIZE); });
+    measure("memcpy unaligned", [] { memcpy(dest + 1, src + 3, SIZE - 3); });
+    measure("byte fill", [] { byte_fill(dest, 1, SIZE); });
+    measure("memset", [] { memset(dest, 1, SIZE); });
+    measure("bzero", [] { bzero(dest, SIZE); });
+}
+
+#endif
@@ -0,0 +1,11 @@
+#ifndef _MEMBENCH_H_
+#define _MEMBENCH_H_
+
+// Measures memcpy/memset/bzero throughput against plain byte loops and
+// prints the results. Only built with -DMEMBENCH, e.g.
+//     make UTCS_OPT="-O3 -DMEMBENCH" ...
+#ifdef MEMBENCH
+extern void membench();
+#endif
+
+#endif
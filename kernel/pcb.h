@@ -5,7 +5,10 @@
 #include "future.h"
 #include "physmem.h"
 #include "ext2.h"
-#include "bb.h"
+#include "pipe.h"
+#include "table.h"
+#include "vmm.h"
+#include "elf.h"
 
 extern Ext2* fs;
 
@@ -37,28 +40,174 @@ extern void switch_processes(UserContext user_context);
 
 struct FileDescriptor {
     Node* vnode = nullptr;
-    Atomic<uint32_t>* offset;
+    Atomic<uint32_t>* offset = nullptr;        // owned, shared by dup'ed and inherited copies
     bool readable, writable;
-    BoundedBuffer<char>* pipe = nullptr;
+    Shared<Pipe> pipe{};
 
     FileDescriptor(Node* node, Atomic<uint32_t>* offset) : vnode(node), offset(offset), 
         readable(true), writable(false) {}
     
     FileDescriptor(bool readable, bool writable) : readable(readable), writable(writable) {}
 
-    FileDescriptor(bool readable, bool writable, BoundedBuffer<char>* pipe) : readable(readable), writable(writable), pipe(pipe) {}
+    FileDescriptor(bool readable, bool writable, Shared<Pipe> pipe) : readable(readable), writable(writable), pipe(pipe) {}
+
+    FileDescriptor(const FileDescriptor&) = delete;
+
+    ~FileDescriptor() {
+        delete offset;
+    }
+};
+
+class PCB;
+struct Ring;
+
+// What getrusage reports about a process or thread. Ticks are timer
+// interrupts that found it running.
+//
+// The layout is also what getrusage copies out.
+struct ResourceUsage {
+    uint32_t user_ticks;                       // in user mode
+    uint32_t kernel_ticks;                     // in a system call or page fault
+    uint32_t voluntary;                        // blocked or yielded
+    uint32_t involuntary;                      // preempted at the end of its time slice
+    uint32_t minor_faults;                     // page faults served without the disk
+    uint32_t syscalls;                         // kernel entries, a ring batch counts once
+    uint64_t bytes_read;                       // read, readv, and splice from a file or pipe
+    uint64_t bytes_written;                    // write, writev, and splice to a pipe or the console
+
+    void add(const ResourceUsage& other) {
+        user_ticks += other.user_ticks;
+        kernel_ticks += other.kernel_ticks;
+        voluntary += other.voluntary;
+        involuntary += other.involuntary;
+        minor_faults += other.minor_faults;
+        syscalls += other.syscalls;
+        bytes_read += other.bytes_read;
+        bytes_written += other.bytes_written;
+    }
+};
+
+// Every PCB embeds one of these so blocking and preemption can queue the
+// process without allocating a continuation. A process waits for at most
+// one thing at a time, so the event is in at most one queue
+struct ResumeEvent : public impl::Event {
+    PCB* const pcb;
+    void (*prepare)(PCB*) = nullptr;     // runs once, right before the process resumes
+
+    explicit ResumeEvent(PCB* pcb) : pcb(pcb) {
+        owned = false;
+    }
+
+    void doit() override;
+};
+
+// What the threads of a process share besides the page directory and the
+// vme queue, which they all point to
+struct ThreadGroup {
+    SpinLock lock{};                           // guards the vmes and the user page tables
+    Atomic<uint32_t> threads{1};               // threads that haven't exited
+    PCB* const leader;                         // the first thread, the one the parent joins
+    PCB* members = nullptr;                    // the threads nobody joined yet, linked by next_thread
+    uint32_t parent_pid = 0;                   // the process that forked or spawned this one, 0 for init
+
+    VMEQueue* queue;                           // owned, every thread's PCB::queue
+    Table<Semaphore> semaphores;
+    Table<FileDescriptor> file_descriptor;
+
+    // Frames unmapped while other threads were running: their cores may
+    // still have them in the TLB. Freed once a lone thread has flushed its
+    // own TLB, or with the address space
+    uint32_t* deferred = nullptr;
+    uint32_t deferred_count = 0;
+    uint32_t deferred_capacity = 0;
+
+    ThreadGroup(PCB* leader, uint32_t max_semaphores, uint32_t max_files) : leader(leader),
+        queue(new VMEQueue()), semaphores(max_semaphores), file_descriptor(max_files) {}
+    ThreadGroup(const ThreadGroup&) = delete;
+
+    ~ThreadGroup() {
+        delete queue;
+        delete[] deferred;
+    }
+
+    // gives back a frame that was just unmapped, needs the lock
+    void release_frame(uint32_t frame) {
+        if (threads == 1) {
+            PhysMem::dealloc_frame(frame);
+            return;
+        }
+        if (deferred_count == deferred_capacity) {
+            uint32_t capacity = (deferred_capacity == 0) ? 64 : deferred_capacity * 2;
+            uint32_t* bigger = new uint32_t[capacity];
+            for (uint32_t i = 0; i < deferred_count; i++) {
+                bigger[i] = deferred[i];
+            }
+            delete[] deferred;
+            deferred = bigger;
+            deferred_capacity = capacity;
+        }
+        deferred[deferred_count++] = frame;
+    }
+
+    // frees the deferred frames, only once no other core can have them
+    // in its TLB. Needs the lock
+    void free_deferred() {
+        for (uint32_t i = 0; i < deferred_count; i++) {
+            PhysMem::dealloc_frame(deferred[i]);
+        }
+        deferred_count = 0;
+    }
 };
 
 class PCB {
 public:
+    static Atomic<uint32_t> next_pid;
+    static Atomic<uint32_t> live;              // PCBs not deleted yet, for leak checks
+
+    // every PCB by pid, for kill_pid
+    static constexpr uint32_t REGISTRY_BUCKETS = 64;
+    static SpinLock registry_lock;
+    static PCB* registry[REGISTRY_BUCKETS];
+    PCB* next_registered;
+
+    const uint32_t pid;
     uint32_t page_directory;
+    ResumeEvent resume_event;
     Future<uint32_t> exit_future;
     UserContext user_context;
 
     uint32_t size, capacity;
     PCB** children;
 
-    Shared<Semaphore>* semaphores;
+    PCB* parent;
+    bool reaped;                               // its exit code was collected by a join
+    uint32_t unreaped;                         // children whose exit code nobody collected yet
+
+    // A PCB is deleted once both its exit path and whoever reaps it (the
+    // parent, a thread_join, or the last thread of its process if nobody
+    // will) are done with it, each drops one hold
+    Atomic<uint32_t> holds;
+
+    // children that exited, oldest first, for join_any. Also guards this
+    // PCB's own parent pointer, which goes away when the parent exits
+    SpinLock exited_lock;
+    PCB* exited_first;
+    PCB* exited_last;
+    PCB* next_exited;
+    bool waiting_any;                          // blocked in join_any, the next exit wakes it
+
+    PCB* wait_child;                           // what join_any / waitpid report to
+    uint32_t* wait_status;                     // when they resume
+
+    static constexpr uint32_t MAX_SEMAPHORES = 1024;
+    static constexpr uint32_t MAX_FILES = 1024;
+    static constexpr uint32_t THREAD_STACK_SIZE = 0x40000;
+
+    Shared<ThreadGroup> group;                 // shared by the threads of this process
+    PCB* next_thread;
+    uint32_t thread_stack;                     // the stack vme of a thread made by thread_create, 0 for the leader
+
+    Table<Semaphore>& semaphores;              // the group's
 
     bool in_handler;
     uint32_t handler_eip;
@@ -66,27 +215,137 @@ public:
 
     VMEQueue* queue;
 
-    Shared<FileDescriptor>* file_descriptor;
+    Table<FileDescriptor>& file_descriptor;    // the group's
     Node* cwd_node;                            // current working directory node
 
-    bool killed;
+    Atomic<bool> killed;                       // set by kill from any core
     uint32_t killed_v;
     bool handled;
 
-    PCB(uint32_t page_directory) : page_directory(page_directory), exit_future(), size(0), 
-        capacity(1), children(new PCB*[1]), semaphores(new Shared<Semaphore>[100]),
-        in_handler(false), handler_eip(0), queue(new VMEQueue()), 
-        file_descriptor(new Shared<FileDescriptor>[10]), cwd_node(), killed(false), killed_v(0),
-        handled(false) {
-            // add user stack onto vme
-            queue->add_vme(new VME(0xF0000000 - 0x100000, 0x100000));
+    // what a blocked system call waits on, so kill can take it back.
+    // Cleared when the process resumes (join_any uses waiting_any)
+    SpinLock wait_lock;
+    Shared<Semaphore> waiting_sem;
+    volatile uint32_t waiting_futex;
+    PCB* waiting_exit;                         // join, waitpid, thread_join: whose exit_future
+    Shared<Pipe> waiting_pipe;                 // a pipe transfer, woken through waiting_retry
+    impl::Event* waiting_retry;
+
+    uint32_t last_cpu;                         // core this process last ran on, its caches are warm there
+    uint32_t affinity;                         // cores this process may run on, one bit per core
+
+    // time slice length in jiffies. Adapts unless fixed by sched_quantum:
+    // doubles when a slice is used up, halves when the process blocks early
+    static constexpr uint32_t MIN_QUANTUM = 1;
+    static constexpr uint32_t DEFAULT_QUANTUM = 4;
+    static constexpr uint32_t MAX_QUANTUM = 32;
+    uint32_t quantum;
+    bool fixed_quantum;
+
+    Ring* ring;                                // batch system call ring, set up by ring_setup
+    uint32_t ring_completed;                   // completions posted by the current ring_enter
+
+    Shared<ElfImage> image;                    // the program, keeps its shared text frames alive
+
+    ResourceUsage usage;                       // only changed by the core running it (or waking it)
+    ResourceUsage children_usage;              // of the children it reaped, and theirs
+
+private:
+    PCB(uint32_t page_directory, Shared<ThreadGroup> group) : pid(next_pid.fetch_add(1)),
+        page_directory(page_directory), resume_event(this), exit_future(), size(0), 
+        capacity(1), children(new PCB*[1]), parent(nullptr), reaped(false), unreaped(0), holds(2), exited_lock(),
+        exited_first(nullptr), exited_last(nullptr), next_exited(nullptr), waiting_any(false),
+        wait_child(nullptr), wait_status(nullptr), group(group), next_thread(nullptr), thread_stack(0),
+        semaphores(group->semaphores), in_handler(false), handler_eip(0), queue(group->queue), 
+        file_descriptor(group->file_descriptor), cwd_node(), killed(false), killed_v(0),
+        handled(false), wait_lock(), waiting_sem(), waiting_futex(0), waiting_exit(nullptr),
+        waiting_pipe(), waiting_retry(nullptr), last_cpu(SMP::me()), affinity(~uint32_t(0)), quantum(DEFAULT_QUANTUM),
+        fixed_quantum(false), ring(nullptr), ring_completed(0), usage(), children_usage() {
+            live.fetch_add(1);
+            registry_lock.lock();
+            PCB** bucket = &registry[pid % REGISTRY_BUCKETS];
+            next_registered = *bucket;
+            *bucket = this;
+            registry_lock.unlock();
+
+            LockGuard g{group->lock};
+            next_thread = group->members;
+            group->members = this;
+        }
+
+public:
+    // a new process with a single thread
+    PCB(uint32_t page_directory) : PCB(page_directory,
+        Shared<ThreadGroup>::make(this, MAX_SEMAPHORES, MAX_FILES)) {
+            add_stack_vme();
         }
 
+    // the main thread's user stack, just below 0xF0000000
+    void add_stack_vme() {
+        queue->add_vme(new VME(0xF0000000 - 0x100000, 0x100000));
+    }
+
+    // another thread in the process of "thread_of", the caller gives it a
+    // stack and counts it in group->threads
+    static PCB* new_thread(PCB* thread_of) {
+        return new PCB(thread_of->page_directory, thread_of->group);
+    }
+
+    // the group (with the vmes, descriptors and semaphores) goes with the
+    // last of its PCBs
     ~PCB() {
+        registry_lock.lock();
+        PCB** link = &registry[pid % REGISTRY_BUCKETS];
+        while (*link != this) {
+            link = &(*link)->next_registered;
+        }
+        *link = next_registered;
+        registry_lock.unlock();
+
         delete[] children;
-        delete queue;
+        live.fetch_add(-1);
+    }
+
+    // the PCB with this pid, with an extra hold the caller releases.
+    // nullptr if there is none (or it is being deleted)
+    static PCB* find(uint32_t pid) {
+        LockGuard g{registry_lock};
+        for (PCB* it = registry[pid % REGISTRY_BUCKETS]; it != nullptr; it = it->next_registered) {
+            if (it->pid == pid) {
+                uint32_t n = it->holds;
+                while (n != 0) {
+                    if (it->holds.compare_exchange(n, n + 1)) {
+                        return it;
+                    }
+                }
+                return nullptr;
+            }
+        }
+        return nullptr;
+    }
+
+    // drops one of the two holds, the second one deletes the PCB
+    void release() {
+        if (holds.add_fetch(-1) == 0) {
+            delete this;
+        }
+    }
+
+    // the other thread of this process with the given pid, marked as
+    // joined so nobody else waits for it too. nullptr if it doesn't exist
+    // or someone joined it already
+    PCB* claim_thread(uint32_t tid) {
+        LockGuard g{group->lock};
+        for (PCB* it = group->members; it != nullptr; it = it->next_thread) {
+            if (it->pid == tid && it != this && it != group->leader && !it->reaped) {
+                it->reaped = true;
+                return it;
+            }
+        }
+        return nullptr;
     }
 
+    // unmaps the vme containing addr, needs group->lock
     bool remove_from_vmequeue(uint32_t addr) {
         VME* removed_vme = queue->remove(addr);
         if (removed_vme == nullptr) {
@@ -109,21 +368,49 @@ public:
                 for (uint32_t pti = start; pti < end; pti++) {
                     uint32_t pte = page_table[pti];
                     if ((pte & 1) == 1) {
-                        uint32_t data_frame = page_table[pti] & 0xFFFFF000;
-                        PhysMem::dealloc_frame(data_frame);
+                        if ((pte & VMM::SHARED) == 0) {
+                            uint32_t data_frame = page_table[pti] & 0xFFFFF000;
+                            group->release_frame(data_frame);
+                        }
                         page_table[pti] = 0;
                     }
                 }
                 if (start == 0 && end == 1024) {
-                    PhysMem::dealloc_frame((uint32_t)(page_table));
+                    group->release_frame((uint32_t)(page_table));
                     ((uint32_t*)page_directory)[pdi] = 0;
                 }
             }
         }
+        delete removed_vme;
 
         return true;
     }
 
+    // the core whose queue this process should wait in: the one it last
+    // ran on if still allowed, otherwise the lowest allowed core
+    uint32_t home_core() {
+        if ((affinity & (1 << last_cpu)) != 0) {
+            return last_cpu;
+        }
+        return __builtin_ctz(affinity);
+    }
+
+    // ran until preempted, probably cpu bound
+    void slice_expired() {
+        usage.involuntary += 1;
+        if (!fixed_quantum && quantum < MAX_QUANTUM) {
+            quantum <<= 1;
+        }
+    }
+
+    // gave up the cpu on its own, probably interactive
+    void slice_yielded() {
+        usage.voluntary += 1;
+        if (!fixed_quantum && quantum > MIN_QUANTUM) {
+            quantum >>= 1;
+        }
+    }
+
     void resize() {
         PCB** new_children = new PCB*[capacity << 1];
         for (uint32_t i = 0; i < capacity; i++) {
@@ -145,6 +432,116 @@ public:
         }
         children[size] = child;
         size++;
+        child->parent = this;
+        child->group->parent_pid = group->leader->pid;
+        unreaped++;
+    }
+
+    // a child that hasn't been reaped, nullptr if there is none with that pid
+    PCB* find_child(uint32_t pid) {
+        for (uint32_t i = 0; i < size; i++) {
+            if (children[i]->pid == pid && !children[i]->reaped) {
+                return children[i];
+            }
+        }
+        return nullptr;
+    }
+
+    // the child's exit code has been collected, forget about it. The caller
+    // releases it once it is done reading its exit code
+    void reap(PCB* child) {
+        for (uint32_t i = size; i > 0; i--) {
+            if (children[i - 1] == child) {
+                for (uint32_t j = i; j < size; j++) {
+                    children[j - 1] = children[j];
+                }
+                size--;
+                break;
+            }
+        }
+        unreaped--;
+        children_usage.add(child->usage);
+        children_usage.add(child->children_usage);
+
+        LockGuard g{exited_lock};
+        child->reaped = true;
+        PCB** link = &exited_first;
+        PCB* prev = nullptr;
+        while (*link != nullptr && *link != child) {
+            prev = *link;
+            link = &prev->next_exited;
+        }
+        if (*link == child) {
+            *link = child->next_exited;
+            if (exited_last == child) {
+                exited_last = prev;
+            }
+        }
+    }
+
+    // an exiting thread gives up on its children: nobody can join them
+    // anymore, so each is deleted once it is done exiting
+    void orphan_children() {
+        exited_lock.lock();
+        exited_first = nullptr;
+        exited_last = nullptr;
+        exited_lock.unlock();
+
+        for (uint32_t i = 0; i < size; i++) {
+            PCB* child = children[i];
+            child->exited_lock.lock();
+            child->parent = nullptr;
+            child->exited_lock.unlock();
+            child->release();
+        }
+        size = 0;
+        unreaped = 0;
+    }
+
+    // called by an exiting child, with the child's exited_lock held.
+    // Returns true if this process was waiting in join_any and has to be
+    // woken up
+    bool child_exited(PCB* child) {
+        LockGuard g{exited_lock};
+        if (child->reaped) {
+            // join or waitpid got to it first
+            return false;
+        }
+        child->next_exited = nullptr;
+        if (exited_last == nullptr) {
+            exited_first = child;
+        } else {
+            exited_last->next_exited = child;
+        }
+        exited_last = child;
+        bool wake = waiting_any;
+        waiting_any = false;
+        return wake;
+    }
+
+    // the child that exited first among those not reaped yet. If there is
+    // none and "wait" is set, the next child to exit wakes this process
+    PCB* take_exited(bool wait) {
+        LockGuard g{exited_lock};
+        PCB* child = exited_first;
+        if (child != nullptr) {
+            exited_first = child->next_exited;
+            if (exited_first == nullptr) {
+                exited_last = nullptr;
+            }
+            return child;
+        }
+        waiting_any = wait;
+        return nullptr;
+    }
+
+    // takes back a take_exited(true) that nobody woke yet, false if a
+    // child's exit got to it first
+    bool stop_waiting_any() {
+        LockGuard g{exited_lock};
+        bool was = waiting_any;
+        waiting_any = false;
+        return was;
     }
 
     PCB* peek_child() {
@@ -152,15 +549,10 @@ public:
         return children[size - 1];
     }
 
-    PCB* remove_child() {
-        size--;
-        return children[size];
-    }
-
     void init_file_descriptor() {
-        file_descriptor[0] = Shared<FileDescriptor>::make(false, false);
-        file_descriptor[1] = Shared<FileDescriptor>::make(false, true);
-        file_descriptor[2] = Shared<FileDescriptor>::make(false, true);
+        file_descriptor.set(0, Shared<FileDescriptor>::make(false, false));
+        file_descriptor.set(1, Shared<FileDescriptor>::make(false, true));
+        file_descriptor.set(2, Shared<FileDescriptor>::make(false, true));
         cwd_node = fs->root;
     }
 };
@@ -15,6 +15,7 @@ namespace PhysMem {
     static Frame* firstFree = nullptr;
     static uint32_t avail;
     static uint32_t limit;
+    static uint32_t in_use = 0;
 
     uint32_t alloc_frame() {
         LockGuard g{lock};
@@ -33,6 +34,7 @@ namespace PhysMem {
         }
 
         ASSERT(offset(p) == 0);
+        in_use++;
 
         bzero((void*)p,FRAME_SIZE);
 
@@ -47,6 +49,12 @@ namespace PhysMem {
         Frame* f = (Frame*) p;    
         f->next = firstFree;
         firstFree = f;
+        in_use--;
+    }
+
+    uint32_t frames_in_use() {
+        LockGuard g{lock};
+        return in_use;
     }
 
 
@@ -27,6 +27,9 @@ namespace PhysMem {
     uint32_t alloc_frame();
 
     void dealloc_frame(uint32_t);
+
+    // frames allocated and not given back yet
+    uint32_t frames_in_use();
 }
 
 #endif
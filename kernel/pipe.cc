@@ -0,0 +1,19 @@
+#include "pipe.h"
+#include "machine.h"
+
+uint32_t Pipe::read(char* buffer, uint32_t count, impl::Event* e) {
+    auto n = read_to(count, [&buffer](const char* src, uint32_t n) {
+        memcpy(buffer, src, n);
+        buffer += n;
+    }, e);
+    return (n < 0) ? 0 : n;
+}
+
+uint32_t Pipe::write(const char* buffer, uint32_t count, impl::Event* e) {
+    auto n = write_from(count, [&buffer](char* dest, uint32_t n) {
+        memcpy(dest, buffer, n);
+        buffer += n;
+        return n;
+    }, e);
+    return (n < 0) ? 0 : n;
+}
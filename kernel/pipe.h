@@ -0,0 +1,103 @@
+#pragma once
+
+#include "stdint.h"
+#include "atomic.h"
+#include "queue.h"
+#include "events.h"
+#include "libk.h"
+
+// A byte stream backed by a ring buffer.
+//
+// read and write move as many bytes as they can right away and return how
+// many moved. When nothing can move (read from an empty pipe, write to a
+// full one) they queue an event to run once the other side makes progress
+// and return 0; the event is expected to try again.
+class Pipe {
+    SpinLock lock{};
+    char* const data;
+    const uint32_t capacity;
+    uint32_t head = 0;                      // next byte to read
+    uint32_t used = 0;                      // bytes in the buffer
+    Queue<impl::Event, NoLock> readers{};   // waiting for data
+    Queue<impl::Event, NoLock> writers{};   // waiting for room
+
+public:
+    static constexpr uint32_t DEFAULT_CAPACITY = 4096;
+    static constexpr uint32_t MAX_CAPACITY = 65536;
+
+    explicit Pipe(uint32_t capacity = DEFAULT_CAPACITY) : data(new char[capacity]), capacity(capacity) {}
+    Pipe(const Pipe&) = delete;
+    ~Pipe() {
+        delete[] data;
+    }
+
+    // Moves up to "count" bytes into the pipe, produced by fill(dest, n) which
+    // writes at most n bytes at dest and returns how many it wrote; it runs
+    // under the pipe lock, twice when the free space wraps around.
+    // Returns -1 when the pipe is full, after queueing e (unless nullptr)
+    template <typename Fill>
+    int32_t write_from(uint32_t count, const Fill& fill, impl::Event* e) {
+        lock.lock();
+        if (used == capacity) {
+            if (e != nullptr) {
+                writers.add(e);
+            }
+            lock.unlock();
+            return -1;
+        }
+
+        uint32_t room = K::min(count, capacity - used);
+        uint32_t tail = (head + used) % capacity;
+        uint32_t first = K::min(room, capacity - tail);
+        uint32_t n = fill(data + tail, first);
+        if (n == first && room > first) {
+            n += fill(data, room - first);
+        }
+        used += n;
+
+        auto waiting = (n != 0) ? readers.remove_all() : nullptr;
+        lock.unlock();
+
+        impl::ready_queue.add_all(waiting);
+        return n;
+    }
+
+    // Moves up to "count" bytes out of the pipe, handed to drain(src, n)
+    // under the pipe lock, twice when the data wraps around.
+    // Returns -1 when the pipe is empty, after queueing e (unless nullptr)
+    template <typename Drain>
+    int32_t read_to(uint32_t count, const Drain& drain, impl::Event* e) {
+        lock.lock();
+        if (used == 0) {
+            if (e != nullptr) {
+                readers.add(e);
+            }
+            lock.unlock();
+            return -1;
+        }
+
+        uint32_t n = K::min(count, used);
+        uint32_t first = K::min(n, capacity - head);
+        drain(data + head, first);
+        drain(data, n - first);
+        head = (head + n) % capacity;
+        used -= n;
+
+        auto waiting = writers.remove_all();
+        lock.unlock();
+
+        impl::ready_queue.add_all(waiting);
+        return n;
+    }
+
+    // takes back an e queued by read_to / write_from, false if the other
+    // side already woke it
+    bool cancel(impl::Event* e) {
+        LockGuard g{lock};
+        return readers.remove(e) || writers.remove(e);
+    }
+
+    // e == nullptr means don't wait
+    uint32_t read(char* buffer, uint32_t count, impl::Event* e);
+    uint32_t write(const char* buffer, uint32_t count, impl::Event* e);
+};
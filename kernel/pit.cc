@@ -6,6 +6,8 @@
 #include "pcb.h"
 #include "kernel.h"
 #include "sys.h"
+#include "sched_stats.h"
+#include "console.h"
 
 /*
  * The old PIT runs at a fixed frequency of 1193182Hz but doesn't support
@@ -142,38 +144,49 @@ extern "C" void apitHandler(UserContext user_context) {
     auto id = SMP::me();
     if (id == 0) {
         Pit::jiffies = Pit::jiffies + 1;
+        if (console != nullptr) {
+            // in case a UART interrupt got lost
+            console->drain();
+        }
     }
     SMP::eoi_reg.set(0);
 
+    // charge the tick, and sample the load of this core
+    bool running = in_process.mine();
+    if ((user_context.iFrame.cs & 0x3) != 0) {
+        active_pcbs.mine()->usage.user_ticks += 1;
+    } else if (running) {
+        active_pcbs.mine()->usage.kernel_ticks += 1;
+    }
+    SchedStats::sample_load(impl::core_queues.mine().length() + (running ? 1 : 0));
+
+    // only preempt once the running process has used up its time slice
+    uint32_t left = slice_left.mine();
+    if (left > 0) {
+        left--;
+        slice_left.mine() = left;
+    }
+
     // if the code segment is from the kernel, this is a kernel interrupt
     // can't yield while in the kernel, so you set a bool to delay the yield 
     // until the kernel is about to go back
     if ((user_context.iFrame.cs & 0x3) == 0) {
-        interrupts.mine() = true;
+        if (left == 0) {
+            interrupts.mine() = true;
+        }
         return;
     }
 
     // check if this process has been killed
     PCB* pcb = active_pcbs.mine();
-    if (pcb->killed && !pcb->handled && !pcb->in_handler) {
-        pcb->handled = true;
-        if (pcb->handler_eip == 0) {
-            // if the child doesn't have a handler, then it is forced to exit with status 'v'
-            exit(pcb->killed_v);
-        }
-        else {
-            // if the child has a handler then 'v' is passed as the 'arg'
-            // call the handler to handle segmentation violation exception
-            pcb->handler_user_context = user_context;
-            pcb->in_handler = true;
-            uint32_t esp = user_context.iFrame.esp;
-            *(uint32_t*)(esp - 128 - 4) = pcb->killed_v;
-            *(uint32_t*)(esp - 128 - 8) = 2;
-            *(uint32_t*)(esp - 128 - 12) = 0x2000;
-            switchToUser(pcb->handler_eip, esp - 128 - 12, 0);
-        }
+    check_killed(pcb, user_context);
+
+    if (left != 0) {
+        return;
     }
 
     // switch processes
+    pcb->slice_expired();
+    SchedStats::switched(false);
     switch_processes(user_context);
 }
@@ -9,7 +9,7 @@ template <typename T, typename LockType>
 class Queue {
     T * volatile first = nullptr;
     T * volatile last = nullptr;
-    uint32_t size;
+    volatile uint32_t size;
     LockType lock;
 public:
     Queue() : first(nullptr), last(nullptr), size(0), lock() {}
@@ -33,6 +33,29 @@ public:
             last->next = t;
         }
         last = t;
+        size = size + 1;
+    }
+
+    // appends a whole nullptr terminated chain in one critical section
+    void add_all(T* list) {
+        if (list == nullptr) {
+            return;
+        }
+        uint32_t n = 1;
+        T* tail = list;
+        while (tail->next != nullptr) {
+            tail = tail->next;
+            n++;
+        }
+
+        LockGuard g{lock};
+        if (first == nullptr) {
+            first = list;
+        } else {
+            last->next = list;
+        }
+        last = tail;
+        size = size + n;
     }
 
     T* remove() {
@@ -45,17 +68,62 @@ public:
         if (first == nullptr) {
             last = nullptr;
         }
+        size = size - 1;
         return it;
     }
 
+    // removes the first element only if "pred(first)" holds
+    template <typename Pred>
+    T* remove_if(const Pred& pred) {
+        LockGuard g{lock};
+        if (first == nullptr || !pred(first)) {
+            return nullptr;
+        }
+        auto it = first;
+        first = it->next;
+        if (first == nullptr) {
+            last = nullptr;
+        }
+        size = size - 1;
+        return it;
+    }
+
+    // takes "t" out of the queue, false if it isn't in it
+    bool remove(T* t) {
+        LockGuard g{lock};
+        T* prev = nullptr;
+        for (T* it = first; it != nullptr; it = it->next) {
+            if (it == t) {
+                if (prev == nullptr) {
+                    first = it->next;
+                } else {
+                    prev->next = it->next;
+                }
+                if (last == it) {
+                    last = prev;
+                }
+                size = size - 1;
+                return true;
+            }
+            prev = it;
+        }
+        return false;
+    }
+
     T* remove_all() {
         LockGuard g{lock};
         auto it = first;
         first = nullptr;
         last = nullptr;
+        size = 0;
         return it;
     }
 
+    // racy snapshot of the number of elements, good enough for load balancing
+    uint32_t length() {
+        return size;
+    }
+
     void clear() {
         LockGuard g{lock};
         T* current = remove();
@@ -68,6 +136,241 @@ public:
     }
 };
 
+// Lock-free multi-producer multi-consumer variant, selected with
+// Queue<T, LockFree>. Elements live in a bounded ring of pointers where each
+// slot carries a sequence number that says whose turn it is (Vyukov's
+// bounded MPMC queue). The ring never dereferences the elements, so there
+// is nothing to reclaim: elements are owned by whoever removes them. Only
+// remove_if's predicate reads one it doesn't own yet; the kernel heap stays
+// mapped, so reading an element that was just freed is harmless.
+//
+// If the ring is full, elements spill into a locked overflow list. Adds keep
+// going there until it drains and consumers take from the ring first, so
+// everything in the ring is older than everything in the overflow. Order is
+// FIFO except for an add that races with the first spill.
+template <typename T>
+class Queue<T, LockFree> {
+    static constexpr uint32_t CAPACITY = 256;        // power of 2, kept small: one ring per core
+    static constexpr uint32_t MASK = CAPACITY - 1;
+
+    struct Slot {
+        volatile uint32_t seq;
+        T* volatile item;
+    };
+
+    Slot slots[CAPACITY];
+    Atomic<uint32_t> head{0};          // next slot to remove from
+    Atomic<uint32_t> tail{0};          // next slot to add to
+    Queue<T, SpinLock> overflow{};
+
+    bool try_add(T* t) {
+        auto pos = tail.get();
+        while (true) {
+            auto slot = &slots[pos & MASK];
+            auto seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+            auto diff = int32_t(seq - pos);
+            if (diff == 0) {
+                // the slot is free, claim it
+                if (tail.compare_exchange(pos, pos + 1)) {
+                    slot->item = t;
+                    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+                    return true;
+                }
+            } else if (diff < 0) {
+                // a whole lap behind the consumers, full
+                return false;
+            } else {
+                pos = tail.get();
+            }
+        }
+    }
+
+    // claims "n" consecutive slots for a batch, so no other producer's
+    // elements end up between them. False if they aren't all free
+    bool try_add_all(T* list, uint32_t n) {
+        if (n > CAPACITY) {
+            return false;
+        }
+        auto pos = tail.get();
+        while (true) {
+            bool free = true;
+            for (uint32_t i = 0; i < n; i++) {
+                auto seq = __atomic_load_n(&slots[(pos + i) & MASK].seq, __ATOMIC_ACQUIRE);
+                if (seq != pos + i) {
+                    free = false;
+                    break;
+                }
+            }
+            if (!free) {
+                auto now = tail.get();
+                if (now == pos) {
+                    // not enough room
+                    return false;
+                }
+                pos = now;
+                continue;
+            }
+            // free slots stay free until tail moves past them
+            if (tail.compare_exchange(pos, pos + n)) {
+                break;
+            }
+        }
+        for (uint32_t i = 0; i < n; i++) {
+            auto next = list->next;
+            list->next = nullptr;
+            auto slot = &slots[(pos + i) & MASK];
+            slot->item = list;
+            __atomic_store_n(&slot->seq, pos + i + 1, __ATOMIC_RELEASE);
+            list = next;
+        }
+        return true;
+    }
+
+    // removes the oldest element
+    T* try_remove() {
+        auto pos = head.get();
+        while (true) {
+            auto slot = &slots[pos & MASK];
+            auto seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+            auto diff = int32_t(seq - (pos + 1));
+            if (diff == 0) {
+                T* t = slot->item;
+                if (head.compare_exchange(pos, pos + 1)) {
+                    // hand the slot back to the producers, one lap later
+                    __atomic_store_n(&slot->seq, pos + CAPACITY, __ATOMIC_RELEASE);
+                    return t;
+                }
+            } else if (diff < 0) {
+                // empty
+                return nullptr;
+            } else {
+                pos = head.get();
+            }
+        }
+    }
+
+public:
+    Queue() {
+        for (uint32_t i = 0; i < CAPACITY; i++) {
+            slots[i].seq = i;
+            slots[i].item = nullptr;
+        }
+    }
+    Queue(const Queue&) = delete;
+    Queue& operator=(Queue&) = delete;
+
+    void monitor_add() {
+        tail.monitor_value();
+    }
+
+    void monitor_remove() {
+        head.monitor_value();
+    }
+
+    void add(T* t) {
+        t->next = nullptr;
+        if (overflow.length() != 0 || !try_add(t)) {
+            overflow.add(t);
+        }
+    }
+
+    // adds a whole nullptr terminated chain as one batch, nothing another
+    // core adds ends up in the middle of it
+    void add_all(T* list) {
+        if (list == nullptr) {
+            return;
+        }
+        uint32_t n = 0;
+        for (T* it = list; it != nullptr; it = it->next) {
+            n++;
+        }
+        if (overflow.length() != 0 || !try_add_all(list, n)) {
+            overflow.add_all(list);
+        }
+    }
+
+    T* remove() {
+        auto t = try_remove();
+        if (t == nullptr && overflow.length() != 0) {
+            t = overflow.remove();
+        }
+        return t;
+    }
+
+    // removes the oldest element only if "pred" accepts it, a rejected one
+    // stays where it is. Another core may remove and free the element while
+    // "pred" looks at it, so "pred" may only read, and its answer only counts
+    // if the element is still at the head afterwards
+    template <typename Pred>
+    T* remove_if(const Pred& pred) {
+        auto pos = head.get();
+        while (true) {
+            auto slot = &slots[pos & MASK];
+            auto seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+            auto diff = int32_t(seq - (pos + 1));
+            if (diff == 0) {
+                T* t = slot->item;
+                bool accepted = pred(t);
+                if (!accepted) {
+                    // head never goes back, so it staying put means nobody
+                    // took "t" while "pred" looked at it
+                    auto now = head.get();
+                    if (now == pos) {
+                        return nullptr;
+                    }
+                    pos = now;
+                } else if (head.compare_exchange(pos, pos + 1)) {
+                    __atomic_store_n(&slot->seq, pos + CAPACITY, __ATOMIC_RELEASE);
+                    return t;
+                }
+            } else if (diff < 0) {
+                // the ring is empty, the overflow is newer
+                return overflow.remove_if(pred);
+            } else {
+                pos = head.get();
+            }
+        }
+    }
+
+    // not a snapshot: elements added while we drain may or may not be included
+    T* remove_all() {
+        T* first = nullptr;
+        T* last = nullptr;
+        while (true) {
+            auto t = try_remove();
+            if (t == nullptr) break;
+            t->next = nullptr;
+            if (last == nullptr) {
+                first = t;
+            } else {
+                last->next = t;
+            }
+            last = t;
+        }
+        // the overflow is newer than the ring
+        T* rest = overflow.remove_all();
+        if (last == nullptr) {
+            first = rest;
+        } else {
+            last->next = rest;
+        }
+        return first;
+    }
+
+    // racy snapshot of the number of elements, good enough for load balancing
+    uint32_t length() {
+        return (tail.get() - head.get()) + overflow.length();
+    }
+
+    void clear() {
+        T* current = remove();
+        while (current != nullptr) {
+            delete current;
+            current = remove();
+        }
+    }
+};
+
 struct MRUNode{
     MRUNode* next = nullptr;
     MRUNode* prev = nullptr;
@@ -187,8 +490,9 @@ struct VME {
     VME* next = nullptr;
     VME* prev = nullptr;
     uint32_t start, end, size;
+    bool writable;                              // false for shared read only text
 
-    VME(uint32_t addr, uint32_t size) : start(addr), end(addr + size), size(size) {}
+    VME(uint32_t addr, uint32_t size, bool writable = true) : start(addr), end(addr + size), size(size), writable(writable) {}
 };
 
 class VMEQueue {
@@ -302,29 +606,36 @@ public:
         VMEQueue* vme_queue = new VMEQueue();
         auto it = last;
         while (it != nullptr) {
-            vme_queue->add_vme(new VME(it->start, it->size));
+            vme_queue->add_vme(new VME(it->start, it->size, it->writable));
             it = it->prev;
         }
         return vme_queue;
     }
 
-        // check if the whole range [start, end] lies within the vmes
-    bool contains_range(uint32_t start, uint32_t end) {
-        auto it = first;
-        while (it != nullptr) {
-            // you're in this vme range
-            if (start >= it->start && start < it->end) {
-                if (end < it->end) {
-                    return true;
-                }
-                else {
-                    // continue to see if you can build the range
-                    start = it->end;
-                }
+    // how many bytes starting at "va" are covered by vmes (adjacent ones
+    // join up), 0 if va is not in any. With "writing", read only vmes
+    // count as holes
+    uint32_t mapped_from(uint32_t va, bool writing = false) {
+        uint32_t at = va;
+        for (auto it = first; it != nullptr; it = it->next) {
+            if (it->end <= at) {
+                continue;
             }
-            it = it->next;
+            if (it->start > at || (writing && !it->writable)) {
+                // a hole
+                break;
+            }
+            at = it->end;
         }
-        return false;
+        return at - va;
+    }
+
+    // check if the whole range [start, end) lies within the vmes
+    bool contains_range(uint32_t start, uint32_t end, bool writing = false) {
+        if (end <= start) {
+            return end == start;
+        }
+        return mapped_from(start, writing) >= end - start;
     }
 
     bool is_empty() {
@@ -0,0 +1,42 @@
+#ifndef _RING_H_
+#define _RING_H_
+
+#include "stdint.h"
+
+// A batch of system calls shared between a process and the kernel.
+//
+// The process fills submissions at sq_tail and calls ring_enter. The kernel
+// runs them in order, posting one completion per submission at cq_tail, and
+// the process consumes completions from cq_head. An operation that has to
+// wait (down, futex_wait, pipe read/write) holds up the rest of the batch
+// until it is done. If the process is killed, the operation it waits in and
+// everything after it complete with -1.
+//
+// "op" is the system call number: read, write, readv, writev, splice, open,
+// close, up, down, futex_wait or futex_wake.
+
+struct RingSubmission {
+    uint32_t op;
+    uint32_t args[3];
+    uint32_t user_data;         // copied to the completion
+};
+
+struct RingCompletion {
+    uint32_t user_data;
+    int32_t result;
+};
+
+struct Ring {
+    static constexpr uint32_t ENTRIES = 64;
+
+    volatile uint32_t sq_head;  // advanced by the kernel
+    volatile uint32_t sq_tail;  // advanced by the process
+    volatile uint32_t cq_head;  // advanced by the process
+    volatile uint32_t cq_tail;  // advanced by the kernel
+    RingSubmission sq[ENTRIES];
+    RingCompletion cq[ENTRIES];
+};
+
+static_assert(sizeof(Ring) <= 4096);
+
+#endif
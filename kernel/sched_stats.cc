@@ -0,0 +1,99 @@
+#include "sched_stats.h"
+#include "machine.h"
+#include "smp.h"
+#include "config.h"
+#include "debug.h"
+#include "pit.h"
+#include "events.h"
+
+static PerCPU<SchedStats> stats;
+static PerCPU<uint64_t> run_start;
+
+// load averages, the same decay as the classic Unix ones: 2^LOAD_SHIFT
+// times e^(-LOAD_INTERVAL / (60 * minutes))
+static constexpr uint32_t LOAD_DECAY[3] = {1884, 2014, 2037};
+static PerCPU<uint32_t[3]> loads;
+static PerCPU<uint32_t> load_ticks;
+
+static uint32_t bucket(uint64_t cycles) {
+    if (cycles == 0) {
+        return 0;
+    }
+    uint32_t b = 63 - __builtin_clzll(cycles);
+    return (b < SchedStats::BUCKETS) ? b : SchedStats::BUCKETS - 1;
+}
+
+void SchedStats::waited(uint64_t cycles) {
+    stats.mine().queue_wait[bucket(cycles)] += 1;
+}
+
+void SchedStats::dispatched() {
+    stats.mine().dispatches += 1;
+    run_start.mine() = rdtsc();
+}
+
+void SchedStats::switched(bool voluntary) {
+    auto& mine = stats.mine();
+    mine.run_length[bucket(rdtsc() - run_start.mine())] += 1;
+    if (voluntary) {
+        mine.voluntary += 1;
+    } else {
+        mine.involuntary += 1;
+    }
+}
+
+void SchedStats::exited() {
+    stats.mine().run_length[bucket(rdtsc() - run_start.mine())] += 1;
+}
+
+void SchedStats::sample_load(uint32_t runnable) {
+    uint32_t ticks = load_ticks.mine() + 1;
+    if (ticks < Pit::secondsToJiffies(LOAD_INTERVAL)) {
+        load_ticks.mine() = ticks;
+        return;
+    }
+    load_ticks.mine() = 0;
+
+    constexpr uint32_t ONE = 1 << LOAD_SHIFT;
+    // any core can pick up the global ready queue, each gets its share
+    uint32_t shared = (impl::ready_queue.length() * ONE) / kConfig.totalProcs;
+    uint64_t sample = uint64_t(runnable) * ONE + shared;
+    auto& mine = loads.mine();
+    for (uint32_t i = 0; i < 3; i++) {
+        uint64_t decayed = uint64_t(mine[i]) * LOAD_DECAY[i] + sample * (ONE - LOAD_DECAY[i]);
+        mine[i] = decayed >> LOAD_SHIFT;
+    }
+}
+
+void SchedStats::load(uint32_t id, uint32_t out[3]) {
+    for (uint32_t i = 0; i < 3; i++) {
+        out[i] = loads.forCPU(id)[i];
+    }
+}
+
+SchedStats& SchedStats::forCPU(uint32_t id) {
+    return stats.forCPU(id);
+}
+
+void SchedStats::dump() {
+    for (uint32_t id = 0; id < kConfig.totalProcs; id++) {
+        auto& s = stats.forCPU(id);
+        Debug::printf("| %s dispatches %d voluntary %d involuntary %d\n",
+            SMP::names[id], s.dispatches, s.voluntary, s.involuntary);
+        uint32_t load_100[3];
+        for (uint32_t i = 0; i < 3; i++) {
+            load_100[i] = (uint64_t(loads.forCPU(id)[i]) * 100) >> LOAD_SHIFT;
+        }
+        Debug::printf("| %s load x100 %d %d %d\n", SMP::names[id], load_100[0], load_100[1], load_100[2]);
+        for (uint32_t i = 0; i < BUCKETS; i++) {
+            if (s.queue_wait[i] != 0) {
+                Debug::printf("| %s queue wait 2^%d cycles: %d\n", SMP::names[id], i, s.queue_wait[i]);
+            }
+        }
+        for (uint32_t i = 0; i < BUCKETS; i++) {
+            if (s.run_length[i] != 0) {
+                Debug::printf("| %s run length 2^%d cycles: %d\n", SMP::names[id], i, s.run_length[i]);
+            }
+        }
+    }
+}
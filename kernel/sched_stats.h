@@ -0,0 +1,49 @@
+#ifndef _SCHED_STATS_H_
+#define _SCHED_STATS_H_
+
+#include "stdint.h"
+
+// Per-core scheduler statistics. Times are in TSC cycles, histogram
+// bucket i counts samples in [2^i, 2^(i+1)).
+//
+// The layout is also what the sched_stats system call copies out.
+struct SchedStats {
+    static constexpr uint32_t BUCKETS = 32;
+
+    uint32_t queue_wait[BUCKETS];   // runnable work waiting in a ready queue
+    uint32_t run_length[BUCKETS];   // a process on the core, from dispatch until it leaves
+    uint32_t dispatches;            // processes put on the core
+    uint32_t voluntary;             // left the core on its own (join, down, pipe, yield, ...)
+    uint32_t involuntary;           // preempted at the end of its time slice
+
+    // called by the event loop when it picks up work that was queued "cycles" ago
+    static void waited(uint64_t cycles);
+
+    // called when a process starts running on this core
+    static void dispatched();
+
+    // called when the running process leaves this core
+    static void switched(bool voluntary);
+
+    // called when the running process exits
+    static void exited();
+
+    static SchedStats& forCPU(uint32_t id);
+
+    // load averages are fixed point numbers with LOAD_SHIFT fraction bits
+    static constexpr uint32_t LOAD_SHIFT = 11;
+    static constexpr uint32_t LOAD_INTERVAL = 5;    // seconds between samples
+
+    // called on every timer tick with how many processes this core has
+    // running or waiting in its queue. A sample also counts the global
+    // ready queue, split evenly over the cores
+    static void sample_load(uint32_t runnable);
+
+    // the runnable count of core "id", decayed over 1, 5 and 15 minutes
+    static void load(uint32_t id, uint32_t out[3]);
+
+    // prints everything, used at shutdown
+    static void dump();
+};
+
+#endif
@@ -14,4 +14,27 @@ void Semaphore::up() {
         count += 1;
         lock.unlock();
     }
-}
\ No newline at end of file
+}
+
+void Semaphore::up(uint32_t n) {
+    Event* first = nullptr;
+    Event* last = nullptr;
+
+    lock.lock();
+    while (n > 0) {
+        auto e = waiting.remove();
+        if (e == nullptr) break;
+        e->next = nullptr;
+        if (first == nullptr) {
+            first = e;
+        } else {
+            last->next = e;
+        }
+        last = e;
+        n--;
+    }
+    count += n;
+    lock.unlock();
+
+    ready_queue.add_all(first);
+}
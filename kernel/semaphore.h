@@ -19,9 +19,16 @@ public:
 
     void up();
 
-    template <typename Work>
+    // same as calling up() n times, but wakes all the waiters at once
+    void up(uint32_t n);
+
+    template <impl::NotAnEvent Work>
     void down(const Work& work) {
-        auto e = new impl::EventWithWork(work);
+        down(new impl::EventWithWork(work));
+    }
+
+    // schedules the given event once the down succeeds
+    void down(impl::Event* e) {
         lock.lock();
         if (count > 0) {
             count --;
@@ -33,6 +40,15 @@ public:
         }
     }
 
+    // takes back a down(e) that is still waiting, false if it already
+    // succeeded (e is scheduled or has run) or e never waited here
+    bool cancel(impl::Event* e) {
+        lock.lock();
+        bool out = waiting.remove(e);
+        lock.unlock();
+        return out;
+    }
+
     ///////////////////////////////////
     // A sempahore is also awaitable //
     ///////////////////////////////////
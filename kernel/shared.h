@@ -91,7 +91,12 @@ public:
         return Shared<T>{new Counted<T>(args...)};
     }
 
-    bool is_null() {
+    bool is_null() const {
         return ptr == nullptr;
     }
+
+    // how many Shared point at the object, 0 if null
+    uint32_t use_count() const {
+        return (ptr == nullptr) ? 0 : ptr->ref_count.get();
+    }
 };
@@ -8,41 +8,502 @@
 #include "elf.h"
 #include "vmm.h"
 #include "physmem.h"
+#include "smp.h"
+#include "config.h"
+#include "libk.h"
+#include "sched_stats.h"
+#include "ring.h"
+#include "console.h"
+#include "user.h"
+#include "futex.h"
+
+// every core, as a mask. Shifting a uint32_t by 32 is undefined
+static uint32_t all_cores() {
+    if (kConfig.totalProcs >= 32) {
+        return ~uint32_t(0);
+    }
+    return (uint32_t(1) << kConfig.totalProcs) - 1;
+}
+
+// makes "pcb" the process running on this core, with a fresh time slice
+static void dispatch(PCB* pcb) {
+    pcb->last_cpu = SMP::me();
+    slice_left.mine() = pcb->quantum;
+    interrupts.mine() = false;
+    vmm_on(pcb->page_directory);
+    active_pcbs.mine() = pcb;
+    in_process.mine() = true;
+    SchedStats::dispatched();
+}
+
+// the running process is about to give up the core on its own. Call it
+// before publishing the continuation: once that is queued another core
+// can resume the process and change the same fields
+static void yielding(PCB* pcb) {
+    pcb->slice_yielded();
+    SchedStats::switched(true);
+}
+
+// the running process waits for something (yielding() was called and a
+// continuation is registered), give the core to someone else
+static void block() {
+    interrupts.mine() = false;
+    in_process.mine() = false;
+    event_loop();
+}
+
+// queues work that starts running "pcb". Unpinned processes go to the global
+// queue so any idle core can pick them up
+template <typename Work>
+static void go_pcb(PCB* pcb, const Work& work) {
+    if ((pcb->affinity & all_cores()) == all_cores()) {
+        go(work);
+    } else {
+        go_on(pcb->home_core(), pcb->affinity, work);
+    }
+}
+
+void resume_pcb(PCB* pcb) {
+    if ((pcb->affinity & (1 << SMP::me())) == 0) {
+        schedule_pcb(pcb);
+        return;
+    }
+    dispatch(pcb);
+    if (pcb->waiting_futex != 0 || !pcb->waiting_sem.is_null() || pcb->waiting_exit != nullptr) {
+        // whatever it waited on let it go, kill can't take it back anymore
+        LockGuard g{pcb->wait_lock};
+        pcb->waiting_futex = 0;
+        pcb->waiting_sem.reset();
+        pcb->waiting_exit = nullptr;
+    }
+    auto prepare = pcb->resume_event.prepare;
+    if (prepare != nullptr) {
+        pcb->resume_event.prepare = nullptr;
+        prepare(pcb);
+    }
+    check_killed(pcb, pcb->user_context);
+    resume(&pcb->user_context);
+}
+
+// A system call body written as a coroutine, it co_awaits whatever it has
+// to wait for. It starts out on the syscall stack; finish() returns its
+// result if it got that far without waiting, and blocks the process
+// otherwise. The coroutine then goes on from the event loop, on whatever
+// core took the wakeup, as the calling process: in its address space and
+// as the active PCB, which its page faults go to. Its co_return resumes
+// the process with the result in eax (after resume_event.prepare, so the
+// batch ring works the same).
+//
+// The first parameter of the coroutine is the calling PCB.
+class SysCall {
+public:
+    struct promise_type;
+private:
+    using Handle = std::coroutine_handle<promise_type>;
+    Handle handle;
+    explicit SysCall(Handle handle) : handle(handle) {}
+
+    // whoever gets here second, the coroutine or finish(), delivers the result
+    struct Finish {
+        bool await_ready() noexcept {
+            return false;
+        }
+        void await_suspend(Handle handle) noexcept {
+            promise_type& promise = handle.promise();
+            if (!promise.detached.exchange(true)) {
+                // finish() hasn't looked yet and will return the result
+                return;
+            }
+            PCB* pcb = promise.pcb;
+            pcb->user_context.regs.eax = promise.result;
+            handle.destroy();
+            resume_pcb(pcb);
+        }
+        void await_resume() noexcept {}
+    };
+
+    // the first wait still runs on the syscall stack, account for the
+    // process blocking before the awaitable publishes its wakeup
+    template <typename A>
+    struct Blocking {
+        A awaitable;
+        promise_type& promise;
+
+        bool await_ready() {
+            return awaitable.await_ready();
+        }
+        auto await_suspend(Handle handle) {
+            if (!promise.waited) {
+                promise.waited = true;
+                yielding(promise.pcb);
+            }
+            return awaitable.await_suspend(handle);
+        }
+        auto await_resume() {
+            if (promise.waited) {
+                PCB* pcb = promise.pcb;
+                active_pcbs.mine() = pcb;
+                vmm_on(pcb->page_directory);
+            }
+            return awaitable.await_resume();
+        }
+    };
+
+public:
+    struct promise_type {
+        PCB* const pcb;
+        int32_t result = -1;
+        Atomic<bool> detached{false};
+        bool waited = false;                   // went past its first co_await without the result
+
+        template <typename... Args>
+        explicit promise_type(PCB* pcb, Args&...) : pcb(pcb) {}
+
+        SysCall get_return_object() noexcept {
+            return SysCall(Handle::from_promise(*this));
+        }
+        std::suspend_never initial_suspend() noexcept {
+            return {};
+        }
+        Finish final_suspend() noexcept {
+            return {};
+        }
+        template <typename A>
+        Blocking<A> await_transform(A&& awaitable) noexcept {
+            return Blocking<A>{static_cast<A&&>(awaitable), *this};
+        }
+        void return_value(int32_t v) noexcept {
+            result = v;
+        }
+        void unhandled_exception() noexcept {
+        }
+    };
+
+    // the result if the call is done, otherwise blocks the calling process
+    // (and never returns). pcb->user_context must already be saved
+    int32_t finish() {
+        promise_type& promise = handle.promise();
+        if (promise.detached.exchange(true)) {
+            int32_t result = promise.result;
+            handle.destroy();
+            return result;
+        }
+        block();
+        return -1;
+    }
+};
+
+// co_await Attempt(f) makes one try at something that may have to wait for
+// another process: f(e) returns a result >= 0, or queues e to run once it is
+// worth trying again and returns -1 (e == nullptr only asks). A wakeup
+// yields -1 and the caller tries again
+template <typename F>
+class Attempt {
+    const F& f;
+    int32_t result = -1;
+    impl::ResumeCoroutine retry{};
+public:
+    explicit Attempt(const F& f) : f(f) {}
+
+    bool await_ready() {
+        result = f(nullptr);
+        return result >= 0;
+    }
+
+    bool await_suspend(std::coroutine_handle<void> handle) {
+        retry.handle = handle;
+        int32_t n = f(&retry);
+        if (n < 0) {
+            // queued, it may already be running somewhere else
+            return true;
+        }
+        result = n;
+        return false;
+    }
+
+    int32_t await_resume() {
+        return result;
+    }
+};
+
+void schedule_pcb(PCB* pcb) {
+    pcb->resume_event.affinity = pcb->affinity;
+    impl::core_queues.forCPU(pcb->home_core()).add(&pcb->resume_event);
+}
+
+void ResumeEvent::doit() {
+    resume_pcb(pcb);
+}
+
+// resume_event.prepare for join: pop the child and return its exit code
+static void finish_join(PCB* pcb) {
+    PCB* child = pcb->peek_child();
+    pcb->reap(child);
+    pcb->user_context.regs.eax = child->exit_future.take();
+    child->release();
+}
+
+// reaps wait_child for join_any / waitpid: stores its exit code "status"
+// at wait_status (if given) and returns its pid
+static void finish_wait(PCB* pcb, uint32_t status) {
+    PCB* child = pcb->wait_child;
+    pcb->wait_child = nullptr;
+    pcb->reap(child);
+    if (pcb->wait_status != nullptr) {
+        copy_to_user(pcb->wait_status, &status, sizeof(status));
+    }
+    pcb->user_context.regs.eax = child->pid;
+    child->release();
+}
+
+// resume_event.prepare for waitpid, woken through exit_future.get
+static void finish_waitpid(PCB* pcb) {
+    finish_wait(pcb, pcb->wait_child->exit_future.take());
+}
+
+// resume_event.prepare for join_any, woken by the first child to exit.
+// The child came off the exited list, nobody waited on its exit_future
+static void finish_join_any(PCB* pcb) {
+    pcb->wait_child = pcb->take_exited(false);
+    finish_wait(pcb, pcb->wait_child->exit_future.peek());
+}
 
 void switch_processes(UserContext user_context) {
     // get the current pcb and update its user_context
     PCB* pcb = active_pcbs.mine();
     pcb->page_directory = (uint32_t)(getCR3() & 0xFFFFF000);
     pcb->user_context = user_context;
+    in_process.mine() = false;
 
-    // add this pcb back into the event loop so we can come back to it later
-    go([pcb]{
-        vmm_on(pcb->page_directory);
-        active_pcbs.mine() = pcb;
-        resume(&pcb->user_context);
-    });
+    // add this pcb back into the event loop so we can come back to it later,
+    // on the same core unless another one runs out of work
+    schedule_pcb(pcb);
     interrupts.mine() = false;
 
     // get the next pcb through event_loop
     event_loop();
 }
 
+// resume_event.prepare for thread_join: return the thread's exit code
+static void finish_thread_join(PCB* pcb) {
+    PCB* thread = pcb->wait_child;
+    pcb->wait_child = nullptr;
+    pcb->group->lock.lock();
+    PCB** link = &pcb->group->members;
+    while (*link != thread) {
+        link = &(*link)->next_thread;
+    }
+    *link = thread->next_thread;
+    pcb->group->lock.unlock();
+    pcb->user_context.regs.eax = thread->exit_future.take();
+    thread->release();
+}
+
+// ends the calling thread. The process is gone once its last thread is,
+// and that thread's value is what the parent sees
 void exit(uint32_t value) {
-    uint32_t* page_directory = (uint32_t*)(getCR3() & 0xFFFFF000);
-    VMM::free(page_directory);
     PCB* pcb = active_pcbs.mine();
-    pcb->exit_future.set(value);
-    // delete pcb;
+    PCB* leader = pcb->group->leader;
+    uint32_t page_directory = getCR3() & 0xFFFFF000;
+    // the PCB may be gone before the next tick
+    in_process.mine() = false;
+
+    pcb->group->lock.lock();
+    if (pcb->thread_stack != 0) {
+        pcb->remove_from_vmequeue(pcb->thread_stack);
+    }
+    bool last = pcb->group->threads.add_fetch(-1) == 0;
+    PCB* unjoined = nullptr;
+    if (last) {
+        VMM::free((uint32_t*)page_directory);
+        pcb->group->free_deferred();
+        unjoined = pcb->group->members;
+        pcb->group->members = nullptr;
+    }
+    pcb->group->lock.unlock();
+    // the shared text is unmapped, or the other threads hold the image
+    pcb->image.reset();
+
+    // nobody is left to join our children
+    pcb->orphan_children();
+
+    if (pcb != leader) {
+        // for thread_join
+        pcb->exit_future.set(value);
+    }
+    if (last) {
+        leader->exit_future.set(value);
+        leader->exited_lock.lock();
+        PCB* parent = leader->parent;
+        if (parent != nullptr && parent->child_exited(leader)) {
+            // the parent is blocked in join_any
+            impl::ready_queue.add(&parent->resume_event);
+        }
+        leader->exited_lock.unlock();
+
+        // a core that still has the directory in CR3 doesn't touch user
+        // memory before loading another one
+        VMM::release_directory(page_directory);
+
+        // threads nobody joined, the process doesn't need their exit codes
+        while (unjoined != nullptr) {
+            PCB* next = unjoined->next_thread;
+            if (unjoined != leader && !unjoined->reaped) {
+                unjoined->release();
+            }
+            unjoined = next;
+        }
+    }
+
+    // done with our own PCB. The leader's lasts until the whole process is
+    if (pcb != leader) {
+        pcb->release();
+    }
+    if (last) {
+        leader->release();
+    }
+
+    SchedStats::exited();
     interrupts.mine() = false;
     event_loop();
 }
 
+void check_killed(PCB* pcb, const UserContext& user_context) {
+    if (pcb->killed && !pcb->handled && !pcb->in_handler) {
+        pcb->handled = true;
+        if (pcb->handler_eip == 0) {
+            // if the child doesn't have a handler, then it is forced to exit with status 'v'
+            exit(pcb->killed_v);
+        }
+        else {
+            // if the child has a handler then 'v' is passed as the 'arg'
+            // call the handler to handle segmentation violation exception
+            pcb->handler_user_context = user_context;
+            pcb->in_handler = true;
+            uint32_t esp = user_context.iFrame.esp;
+            *(uint32_t*)(esp - 128 - 4) = pcb->killed_v;
+            *(uint32_t*)(esp - 128 - 8) = 2;
+            *(uint32_t*)(esp - 128 - 12) = 0x2000;
+            switchToUser(pcb->handler_eip, esp - 128 - 12, 0);
+        }
+    }
+}
+
+static void resume_ring(PCB* pcb);
+
+// takes a killed process out of the wait it is blocked in, the call
+// returns -1. A pipe transfer is woken instead and gives up on its own.
+// False if it isn't blocked (or a wake got to it first, then it sees the
+// kill when it resumes)
+static bool cancel_wait(PCB* pcb) {
+    pcb->wait_lock.lock();
+    bool cancelled = false;
+    impl::Event* retry = nullptr;
+    if (!pcb->waiting_sem.is_null()) {
+        cancelled = pcb->waiting_sem->cancel(&pcb->resume_event);
+    } else if (pcb->waiting_futex != 0) {
+        cancelled = Futex::cancel(pcb->waiting_futex, &pcb->resume_event);
+    } else if (pcb->waiting_exit != nullptr) {
+        cancelled = pcb->waiting_exit->exit_future.cancel(&pcb->resume_event);
+    } else if (!pcb->waiting_pipe.is_null()) {
+        if (pcb->waiting_pipe->cancel(pcb->waiting_retry)) {
+            retry = pcb->waiting_retry;
+        }
+    } else {
+        cancelled = pcb->stop_waiting_any();
+    }
+    if (cancelled) {
+        pcb->waiting_sem.reset();
+        pcb->waiting_futex = 0;
+        pcb->waiting_exit = nullptr;
+    }
+    pcb->wait_lock.unlock();
+
+    if (retry != nullptr) {
+        // the transfer sees the kill when it tries again
+        impl::ready_queue.add(retry);
+        return true;
+    }
+    if (!cancelled) {
+        return false;
+    }
+    // nothing to collect, a thread_join gives its thread back
+    if (pcb->resume_event.prepare == finish_thread_join) {
+        LockGuard g{pcb->group->lock};
+        pcb->wait_child->reaped = false;
+    }
+    // a batch still posts its completions, the rest of it fails
+    if (pcb->resume_event.prepare != resume_ring) {
+        pcb->resume_event.prepare = nullptr;
+    }
+    pcb->wait_child = nullptr;
+    pcb->user_context.regs.eax = -1;
+    schedule_pcb(pcb);
+    return true;
+}
+
+// blocks "pcb" until "waited" exits, resume_event.prepare collects what
+// it left. kill can take the wait back
+static void wait_for_exit(PCB* pcb, PCB* waited) {
+    pcb->wait_lock.lock();
+    pcb->waiting_exit = waited;
+    pcb->wait_lock.unlock();
+    yielding(pcb);
+    waited->exit_future.get(&pcb->resume_event);
+    if (pcb->killed) {
+        // the kill may have looked before we were waiting
+        cancel_wait(pcb);
+    }
+    block();
+}
+
+// interrupt vector for the kill IPI
+constexpr uint32_t KILL_vector = 42;
+
+// kills "pcb" with status v. A blocked process is woken, one running on
+// another core is interrupted so it doesn't finish its time slice first
+static int32_t do_kill(PCB* pcb, uint32_t v) {
+    if (pcb->killed || pcb->handled) {
+        return -1;
+    }
+    pcb->killed_v = v;
+    pcb->killed = true;
+
+    if (!cancel_wait(pcb)) {
+        for (uint32_t id = 0; id < kConfig.totalProcs; id++) {
+            if (id != SMP::me() && active_pcbs.forCPU(id) == pcb) {
+                SMP::ipi(id, 0x4000 | KILL_vector);
+            }
+        }
+    }
+    return 0;
+}
+
+// true if "target" is one of the caller's threads or belongs to a process
+// it started, directly or through its children. The chain goes through
+// parent pids, so a process whose parent is gone is nobody's descendant
+static bool is_descendant(PCB* caller, PCB* target) {
+    PCB* mine = caller->group->leader;
+    Shared<ThreadGroup> group = target->group;
+    while (group->leader != mine) {
+        PCB* parent = PCB::find(group->parent_pid);
+        if (parent == nullptr) {
+            return false;
+        }
+        group = parent->group;
+        parent->release();
+    }
+    return true;
+}
+
 void switch_interrupt(UserContext user_context, uint32_t value) {
     if (interrupts.mine()) {
         // if you experienced an interrupt during a sys call, switch processes and save this
         // return value in the user context 
         interrupts.mine() = false;
         user_context.regs.eax = value;
+        active_pcbs.mine()->slice_expired();
+        SchedStats::switched(false);
         switch_processes(user_context);
     }
 }
@@ -60,11 +521,20 @@ int32_t sigreturn() {
     return 1;
 }
 
-Node* find_path_node(char* path_name) {
-    // must be within user space
+// longest path find_path_node accepts, including the terminator
+constexpr uint32_t MAX_PATH = 4096;
+
+Node* find_path_node(char* user_path) {
     PCB* pcb = active_pcbs.mine();
-    if ((uint32_t)(path_name) < 0x80000000 || (uint32_t)(path_name) >= 0xF0000000) {
-    // if (!pcb->queue->contains_range((uint32_t)(path_name), (uint32_t)(path_name))) {
+
+    // parse a kernel copy, must be a string in user memory
+    int32_t length = strnlen_user(user_path, MAX_PATH - 1);
+    if (length < 0) {
+        return nullptr;
+    }
+    char* path_name = new char[length + 1];
+    if (strncpy_from_user(path_name, user_path, length + 1) < 0) {
+        delete[] path_name;
         return nullptr;
     }
 
@@ -78,7 +548,8 @@ Node* find_path_node(char* path_name) {
     while (path_name[i] != 0) {
         // the previous node should be a directory
         if (current_node == nullptr || !(current_node->is_dir())) {
-            return nullptr;
+            current_node = nullptr;
+            break;
         }
 
         // '//' is the same as '/', so ignore extra slashes
@@ -90,87 +561,756 @@ Node* find_path_node(char* path_name) {
 
         if (next - i != 0) {
             // split string here, new string is path_name[i, next - 1]
-            char* current_name = new char[next - i + 1];
-            for (uint32_t j = i; j < next; j++) {
-                current_name[j - i] = path_name[j];
-            }
-            current_name[next - i] = 0;
-
-            current_node = fs->find(current_node, current_name);
-            delete[] current_name;
+            char saved = path_name[next];
+            path_name[next] = 0;
+            current_node = fs->find(current_node, path_name + i);
+            path_name[next] = saved;
         }
         
         if (path_name[next] == 0) {
-            i = next;
             break;
         }
         i = next + 1;
     }
-    // must lie within user space
-    if ((uint32_t)(path_name) + i - 1 >= 0xF0000000 || (uint32_t)(path_name) + i - 1 < i - 1) {
-    // if (!pcb->queue->contains_range((uint32_t)(path_name), (uint32_t)(path_name) + i - 1)  || (uint32_t)(path_name) + i - 1 < i - 1) {
-        return nullptr;
-    }
 
+    delete[] path_name;
     return current_node;
 }
 
-int32_t write(uint32_t* userEsp, UserContext user_context) {
-    uint32_t fd = userEsp[1];
-    char* buffer = (char*)(userEsp[2]);
-    size_t count = userEsp[3];
-    
+// The argument strings of execl/spawn, copied into the kernel so they
+// survive the switch to the new address space
+struct Arguments {
+    uint32_t count;
+    char** strings;
+    uint32_t* lengths;                         // including the terminator
+
+    Arguments(uint32_t count) : count(count), strings(new char*[count]), lengths(new uint32_t[count]) {
+        for (uint32_t i = 0; i < count; i++) {
+            strings[i] = nullptr;
+        }
+    }
+    Arguments(const Arguments&) = delete;
+
+    ~Arguments() {
+        for (uint32_t i = 0; i < count; i++) {
+            delete[] strings[i];
+        }
+        delete[] strings;
+        delete[] lengths;
+    }
+
+    // copies the null terminated array of strings at "user_argv",
+    // nullptr if any of it is not in user memory
+    static Arguments* copy(char** user_argv) {
+        uint32_t count = 0;
+        while (true) {
+            char* arg;
+            if (!copy_from_user(&arg, &user_argv[count], sizeof(arg))) {
+                return nullptr;
+            }
+            if (arg == nullptr) break;
+            count++;
+        }
+
+        auto arguments = new Arguments(count);
+        for (uint32_t j = 0; j < count; j++) {
+            // another thread can change argv while we copy, only use what
+            // was copied into the kernel
+            char* arg;
+            if (!copy_from_user(&arg, &user_argv[j], sizeof(arg)) || arg == nullptr) {
+                delete arguments;
+                return nullptr;
+            }
+
+            // arguments must be strings in user memory
+            int32_t length = strnlen_user(arg, MAX_PATH - 1);
+            if (length < 0) {
+                delete arguments;
+                return nullptr;
+            }
+            arguments->strings[j] = new char[length + 1];
+            length = strncpy_from_user(arguments->strings[j], arg, length + 1);
+            if (length < 0) {
+                delete arguments;
+                return nullptr;
+            }
+            arguments->lengths[j] = length + 1;
+        }
+        return arguments;
+    }
+
+    // lays out the strings, argv and argc below "esp" in the current
+    // address space, returns the new stack pointer
+    uint32_t* push(uint32_t* esp) {
+        uint32_t total_length = 0;
+        for (uint32_t j = 0; j < count; j++) {
+            total_length += lengths[j];
+            memcpy((char*)esp - total_length, strings[j], lengths[j]);
+        }
+
+        // align, then a null pointer after argv
+        int32_t i = -(int32_t)((total_length + 3) >> 2);
+        i--;
+        esp[i] = 0;
+
+        // pointers to all strings
+        uint32_t offset = total_length;
+        for (int32_t j = count - 1; j >= 0; j--) {
+            i--;
+            esp[i] = (uint32_t)((char*)esp - offset);
+            offset -= lengths[j];
+        }
+
+        i--;
+        esp[i] = (uint32_t)&esp[i + 1];
+        i--;
+        esp[i] = count;
+        return esp + i;
+    }
+};
+
+// faults in every page of a user buffer, so copying it later can't fault
+// while holding a lock
+static void prefault(char* buffer, uint32_t count) {
+    for (uint32_t offset = 0; offset < count; offset += 4096) {
+        (void) *(volatile char*)(buffer + offset);
+    }
+    (void) *(volatile char*)(buffer + count - 1);
+}
+
+// a pipe transfer of "pcb" is about to queue e on "pipe", kill wakes it
+// through cancel_wait. Cleared by pipe_wait_done before the call returns
+static void pipe_waiting(PCB* pcb, Shared<Pipe> pipe, impl::Event* e) {
+    LockGuard g{pcb->wait_lock};
+    pcb->waiting_pipe = pipe;
+    pcb->waiting_retry = e;
+}
+
+// after a try that returned -1 with e queued: the kill may have looked
+// before we were waiting
+static void pipe_queued(PCB* pcb, impl::Event* e) {
+    if (e != nullptr && pcb->killed) {
+        cancel_wait(pcb);
+    }
+}
+
+static void pipe_wait_done(PCB* pcb) {
+    LockGuard g{pcb->wait_lock};
+    pcb->waiting_pipe.reset();
+    pcb->waiting_retry = nullptr;
+}
+
+// Moves up to "count" bytes between a pipe and "pcb"'s buffer, waiting
+// until at least one can move. Retries run from the event loop, in pcb's
+// address space. -1 if pcb is killed while it waits
+static SysCall pipe_transfer(PCB* pcb, Shared<Pipe> pipe, char* buffer, uint32_t count, bool reading) {
+    auto transfer = [&](impl::Event* e) -> int32_t {
+        if (e != nullptr) {
+            pipe_waiting(pcb, pipe, e);
+        }
+        uint32_t n = reading ? pipe->read(buffer, count, e) : pipe->write(buffer, count, e);
+        if (n == 0) {
+            pipe_queued(pcb, e);
+            return -1;
+        }
+        return n;
+    };
+    int32_t n;
+    while ((n = co_await Attempt(transfer)) < 0) {
+        if (pcb->killed) {
+            break;
+        }
+    }
+    pipe_wait_done(pcb);
+    if (n < 0) {
+        co_return -1;
+    }
+    if (reading) {
+        pcb->usage.bytes_read += n;
+    } else {
+        pcb->usage.bytes_written += n;
+    }
+    co_return n;
+}
+
+// The bodies of the system calls that can also be submitted through the
+// batch ring. The ones that may block save "user_context" in the pcb, leave
+// their result in its eax and don't return when they block
+
+static int32_t do_write(PCB* pcb, uint32_t fd, char* buffer, size_t count, const UserContext& user_context) {
     if (count == 0) {
         return 0;
     }
 
-    PCB* pcb = active_pcbs.mine();
+    if (pcb->file_descriptor[fd].is_null()) {
+        return -1;
+    }
 
-    if (fd >= 10 || pcb->file_descriptor[fd].is_null()) {
+    // must be mapped user memory
+    if (!user_range_ok(buffer, count)) {
         return -1;
     }
 
-    // // must be a valid user-accessible virtual address
-    if ((uint32_t)(buffer) < 0x80000000 || (uint32_t)(buffer) + count >= 0xF0000000 || (uint32_t)(buffer) + count < count) {
-    // if (!pcb->queue->contains_range((uint32_t)buffer, (uint32_t)buffer + count) || (uint32_t)buffer + count < count) {
+    Shared<FileDescriptor> file_descriptor = pcb->file_descriptor[fd];
+    if (!file_descriptor->writable || (file_descriptor->vnode != nullptr && (file_descriptor->vnode->is_dir() || file_descriptor->vnode->is_file()))) {
+        return -1;
+    }
+
+    // write up to count bytes
+    if (!file_descriptor->pipe.is_null()) {
+        // writing to pipe, waits only while it is full
+        prefault(buffer, count);
+        // most calls don't wait, those need no coroutine frame
+        uint32_t n = file_descriptor->pipe->write(buffer, count, nullptr);
+        if (n != 0) {
+            pcb->usage.bytes_written += n;
+            return n;
+        }
+        pcb->page_directory = (uint32_t)(getCR3() & 0xFFFFF000);
+        pcb->user_context = user_context;
+        SysCall call = pipe_transfer(pcb, file_descriptor->pipe, buffer, count, false);
+        // finish may block and never return, drop our reference first
+        file_descriptor.reset();
+        return call.finish();
+    }
+    else {
+        // write to terminal, buffered by the console
+        prefault(buffer, count);
+        console->write(buffer, count);
+        pcb->usage.bytes_written += count;
+        return count;
+    }
+
+    return -1;
+}
+
+static int32_t do_read(PCB* pcb, uint32_t fd, char* buffer, size_t count, const UserContext& user_context) {
+    if (count == 0) {
+        return 0;
+    }
+
+    if (pcb->file_descriptor[fd].is_null()) {
+        return -1;
+    }
+
+    // must be mapped, writable user memory
+    if (!user_range_writable(buffer, count)) {
+        return -1;
+    }
+
+    Shared<FileDescriptor> file_descriptor = pcb->file_descriptor[fd];
+    if (!file_descriptor->readable || (file_descriptor->vnode != nullptr && file_descriptor->vnode->is_dir())) {
+        return -1;
+    }
+
+    // read up to count bytes 
+    if (!file_descriptor->pipe.is_null()) {
+        // reading from pipe, waits only while it is empty
+        prefault(buffer, count);
+        // most calls don't wait, those need no coroutine frame
+        uint32_t n = file_descriptor->pipe->read(buffer, count, nullptr);
+        if (n != 0) {
+            pcb->usage.bytes_read += n;
+            return n;
+        }
+        pcb->page_directory = (uint32_t)(getCR3() & 0xFFFFF000);
+        pcb->user_context = user_context;
+        SysCall call = pipe_transfer(pcb, file_descriptor->pipe, buffer, count, true);
+        // finish may block and never return, drop our reference first
+        file_descriptor.reset();
+        return call.finish();
+    }
+
+    Node* node = file_descriptor->vnode;
+    if (count > node->size_in_bytes() - file_descriptor->offset->get()) {
+        count = node->size_in_bytes() - file_descriptor->offset->get();
+    }
+    int32_t n = file_descriptor->vnode->read_all(file_descriptor->offset->fetch_add(count), count, buffer);
+    // int32_t n = file_descriptor->vnode->read_all(file_descriptor->offset->fetch_add(1), 1, buffer);
+    if (n == -1) {
+        return 0;
+    }
+    pcb->usage.bytes_read += n;
+    return n;
+}
+
+static int32_t do_open(PCB* pcb, char* path_name) {
+    Node* current_node = find_path_node(path_name);
+    if (current_node == nullptr) {
+        return -1;
+    }
+
+    // the lowest available descriptor, -1 if there are none
+    return pcb->file_descriptor.add(Shared<FileDescriptor>::make(current_node, new Atomic<uint32_t>(0)));
+}
+
+static int32_t do_close(PCB* pcb, uint32_t fd) {
+    if (pcb->file_descriptor[fd].is_null()) {
+        return -1;
+    }
+
+    pcb->file_descriptor.clear(fd);
+    return 0;
+}
+
+static int32_t do_up(PCB* pcb, uint32_t i) {
+    if (pcb->semaphores[i].is_null()) {
+        // this does not point to a valid semaphore, return -1
+        return -1;
+    }
+    Shared<Semaphore> semaphore = pcb->semaphores[i];
+    semaphore->up();
+    return 0;
+}
+
+static int32_t do_down(PCB* pcb, uint32_t i, const UserContext& user_context) {
+    // switch processes using semaphore
+    if (pcb->semaphores[i].is_null()) {
+        // this does not point to a valid semaphore, return -1
+        return -1;
+    }
+    Shared<Semaphore> semaphore = pcb->semaphores[i];
+    pcb->user_context = user_context;
+    pcb->user_context.regs.eax = 0;
+    pcb->wait_lock.lock();
+    pcb->waiting_sem = semaphore;
+    pcb->wait_lock.unlock();
+    yielding(pcb);
+    semaphore->down(&pcb->resume_event);
+    // block never returns, drop our reference first
+    semaphore.reset();
+    if (pcb->killed) {
+        // the kill may have looked before we were waiting
+        cancel_wait(pcb);
+    }
+    block();
+    return 0;
+}
+
+// what live_counts reports, to spot leaks across a long run
+struct LiveCounts {
+    uint32_t pcbs;                             // processes and threads not reclaimed yet
+    uint32_t heap_blocks;                      // kernel heap allocations
+    uint32_t frames;                           // physical frames in use
+    uint32_t nodes;                            // i-nodes in the node cache
+};
+
+// one segment of a readv/writev
+struct IoVec {
+    char* base;
+    uint32_t len;
+};
+
+// entries copied out of the user's iovec array at a time, on the kernel stack
+constexpr uint32_t IOV_CHUNK = 16;
+
+// the segment can take the transfer, "reading" segments are written by the kernel
+static bool iovec_entry_ok(const IoVec& segment, bool reading) {
+    if (segment.len == 0) {
+        return true;
+    }
+    return reading ? user_range_writable(segment.base, segment.len) : user_range_ok(segment.base, segment.len);
+}
+
+// checks the whole iovec array and every segment before any data moves.
+// Other threads can change the array afterwards, so the callers check
+// each entry again in the kernel copy they use
+static bool check_iovec(PCB* pcb, uint32_t fd, IoVec* iov, uint32_t iovcnt, bool reading) {
+    if (pcb->file_descriptor[fd].is_null()) {
+        return false;
+    }
+    if (iovcnt > 1024) {
+        return false;
+    }
+    IoVec chunk[IOV_CHUNK];
+    uint32_t total = 0;
+    for (uint32_t i = 0; i < iovcnt; i += IOV_CHUNK) {
+        uint32_t n = K::min(iovcnt - i, IOV_CHUNK);
+        if (!copy_from_user(chunk, &iov[i], n * sizeof(IoVec))) {
+            return false;
+        }
+        for (uint32_t j = 0; j < n; j++) {
+            uint32_t len = chunk[j].len;
+            if (!iovec_entry_ok(chunk[j], reading)) {
+                return false;
+            }
+            if (total + len < total || total + len > 0x7FFFFFFF) {
+                // the total has to fit the return value
+                return false;
+            }
+            total += len;
+        }
+    }
+    return true;
+}
+
+// moves one segment, taken from the kernel copy of the array.
+// Returns how many bytes moved or -1, may block (only when total == 0)
+static int32_t iovec_transfer(PCB* pcb, uint32_t fd, const IoVec& segment, int32_t total, bool reading, const UserContext& user_context) {
+    if (!iovec_entry_ok(segment, reading)) {
+        // changed since check_iovec
+        return -1;
+    }
+    Shared<Pipe> pipe = pcb->file_descriptor[fd]->pipe;
+    int32_t n;
+    if (!pipe.is_null() && total > 0) {
+        // already moved something, don't wait for data or room
+        prefault(segment.base, segment.len);
+        if (reading) {
+            n = pipe->read(segment.base, segment.len, nullptr);
+            pcb->usage.bytes_read += n;
+        } else {
+            n = pipe->write(segment.base, segment.len, nullptr);
+            pcb->usage.bytes_written += n;
+        }
+    } else {
+        // do_read / do_write may block and never come back here
+        pipe.reset();
+        if (reading) {
+            n = do_read(pcb, fd, segment.base, segment.len, user_context);
+        } else {
+            n = do_write(pcb, fd, segment.base, segment.len, user_context);
+        }
+    }
+    return n;
+}
+
+// readv and writev: stop at the end of a file, or at the first segment a
+// pipe could not fill / take completely
+static int32_t do_iovec(PCB* pcb, uint32_t fd, IoVec* iov, uint32_t iovcnt, bool reading, const UserContext& user_context) {
+    if (!check_iovec(pcb, fd, iov, iovcnt, reading)) {
+        return -1;
+    }
+    IoVec chunk[IOV_CHUNK];
+    int32_t total = 0;
+    for (uint32_t i = 0; i < iovcnt; i += IOV_CHUNK) {
+        uint32_t count = K::min(iovcnt - i, IOV_CHUNK);
+        if (!copy_from_user(chunk, &iov[i], count * sizeof(IoVec))) {
+            return (total == 0) ? -1 : total;
+        }
+        for (uint32_t j = 0; j < count; j++) {
+            if (chunk[j].len == 0) {
+                continue;
+            }
+            if (chunk[j].len > 0x7FFFFFFF - (uint32_t)total) {
+                // grew since check_iovec
+                return (total == 0) ? -1 : total;
+            }
+            int32_t n = iovec_transfer(pcb, fd, chunk[j], total, reading, user_context);
+            if (n < 0) {
+                return (total == 0) ? -1 : total;
+            }
+            total += n;
+            if ((uint32_t)n < chunk[j].len) {
+                return total;
+            }
+        }
+    }
+    return total;
+}
+
+static int32_t do_readv(PCB* pcb, uint32_t fd, IoVec* iov, uint32_t iovcnt, const UserContext& user_context) {
+    return do_iovec(pcb, fd, iov, iovcnt, true, user_context);
+}
+
+static int32_t do_writev(PCB* pcb, uint32_t fd, IoVec* iov, uint32_t iovcnt, const UserContext& user_context) {
+    return do_iovec(pcb, fd, iov, iovcnt, false, user_context);
+}
+
+static int32_t do_pipe(PCB* pcb, uint32_t* write_fd, uint32_t* read_fd, uint32_t capacity) {
+    if (!user_range_writable(write_fd, sizeof(uint32_t)) || !user_range_writable(read_fd, sizeof(uint32_t))) {
+        return -1;
+    }
+
+    // goes away with the last descriptor (or waiting transfer) using it
+    Shared<Pipe> pipe = Shared<Pipe>::make(capacity);
+    int32_t w = pcb->file_descriptor.add(Shared<FileDescriptor>::make(false, true, pipe));
+    if (w < 0) {
+        return -1;
+    }
+    int32_t r = pcb->file_descriptor.add(Shared<FileDescriptor>::make(true, false, pipe));
+    if (r < 0) {
+        // need two descriptors
+        pcb->file_descriptor.clear(w);
+        return -1;
+    }
+    *write_fd = w;
+    *read_fd = r;
+    return 0;
+}
+
+// moves up to "count" bytes from a file or pipe to a pipe or the console,
+// returns -1 if it has to wait (after queueing e, unless nullptr)
+static int32_t splice_transfer(Shared<FileDescriptor> in, Shared<FileDescriptor> out, uint32_t count, impl::Event* e) {
+    if (!in->pipe.is_null()) {
+        // pipe to console
+        return in->pipe->read_to(count, [](const char* src, uint32_t n) {
+            console->write(src, n);
+        }, e);
+    }
+
+    Node* node = in->vnode;
+    uint32_t size = node->size_in_bytes();
+    // reads at the descriptor's offset without moving it
+    auto read_file = [node, in, size](char* dest, uint32_t n) -> uint32_t {
+        uint32_t offset = in->offset->get();
+        if (offset >= size) {
+            return 0;
+        }
+        if (n > size - offset) {
+            n = size - offset;
+        }
+        int64_t got = node->read_all(offset, n, dest);
+        return got < 0 ? 0 : got;
+    };
+
+    if (!out->pipe.is_null()) {
+        // file to pipe, through a kernel buffer: the disk read can't run
+        // under the pipe lock. The offset only moves past what the pipe took
+        uint32_t want = K::min(count, Pipe::DEFAULT_CAPACITY);
+        char* buffer = new char[want];
+        uint32_t got = read_file(buffer, want);
+        int32_t n = 0;
+        if (got != 0) {
+            const char* src = buffer;
+            n = out->pipe->write_from(got, [&src](char* dest, uint32_t n) {
+                memcpy(dest, src, n);
+                src += n;
+                return n;
+            }, e);
+            if (n > 0) {
+                in->offset->fetch_add(n);
+            }
+        }
+        delete[] buffer;
+        return n;
+    }
+
+    // file to console, through a small kernel buffer
+    char chunk[256];
+    uint32_t total = 0;
+    while (total < count) {
+        uint32_t n = read_file(chunk, K::min(count - total, (uint32_t) sizeof(chunk)));
+        if (n == 0) break;
+        in->offset->fetch_add(n);
+        console->write(chunk, n);
+        total += n;
+    }
+    return total;
+}
+
+// splice_transfer, retried from the event loop until something moves.
+// -1 if pcb is killed while it waits
+static SysCall splice_or_wait(PCB* pcb, Shared<FileDescriptor> in, Shared<FileDescriptor> out, uint32_t count) {
+    Shared<Pipe> pipe = in->pipe.is_null() ? out->pipe : in->pipe;
+    auto transfer = [&](impl::Event* e) {
+        if (e != nullptr) {
+            pipe_waiting(pcb, pipe, e);
+        }
+        int32_t n = splice_transfer(in, out, count, e);
+        if (n < 0) {
+            pipe_queued(pcb, e);
+        }
+        return n;
+    };
+    int32_t n;
+    while ((n = co_await Attempt(transfer)) < 0) {
+        if (pcb->killed) {
+            break;
+        }
+    }
+    pipe_wait_done(pcb);
+    if (n < 0) {
+        co_return -1;
+    }
+    pcb->usage.bytes_read += n;
+    pcb->usage.bytes_written += n;
+    co_return n;
+}
+
+static int32_t do_splice(PCB* pcb, uint32_t fd_in, uint32_t fd_out, uint32_t count, const UserContext& user_context) {
+    if (pcb->file_descriptor[fd_in].is_null()) {
+        return -1;
+    }
+    if (pcb->file_descriptor[fd_out].is_null()) {
+        return -1;
+    }
+
+    Shared<FileDescriptor> in = pcb->file_descriptor[fd_in];
+    Shared<FileDescriptor> out = pcb->file_descriptor[fd_out];
+    if (!in->readable || !out->writable) {
+        return -1;
+    }
+    // from a file or a pipe
+    if (in->pipe.is_null() && (in->vnode == nullptr || !in->vnode->is_file())) {
+        return -1;
+    }
+    // to a pipe or the console
+    if (out->pipe.is_null() && out->vnode != nullptr) {
+        return -1;
+    }
+    if (!in->pipe.is_null() && !out->pipe.is_null()) {
+        // between two pipes is not supported
+        return -1;
+    }
+
+    if (count == 0) {
+        return 0;
+    }
+
+    // most calls don't wait, those need no coroutine frame
+    int32_t n = splice_transfer(in, out, count, nullptr);
+    if (n >= 0) {
+        pcb->usage.bytes_read += n;
+        pcb->usage.bytes_written += n;
+        return n;
+    }
+    pcb->page_directory = (uint32_t)(getCR3() & 0xFFFFF000);
+    pcb->user_context = user_context;
+    SysCall call = splice_or_wait(pcb, in, out, count);
+    // the call holds on to both, finish may never return to drop ours
+    in.reset();
+    out.reset();
+    return call.finish();
+}
+
+// the physical address of the aligned user word at "addr" names it for
+// Futex, 0 if it is not mapped user memory. Faults the page in
+static uint32_t futex_key(uint32_t* addr) {
+    if (((uint32_t)addr & 3) != 0 || !user_range_ok(addr, sizeof(uint32_t))) {
+        return 0;
+    }
+    // fault it in first, the fault handler takes the group lock itself
+    (void) *(volatile uint32_t*)addr;
+
+    // another thread can unmap it again, walk the tables under the lock
+    // that munmap and the fault handler hold
+    PCB* pcb = active_pcbs.mine();
+    uint32_t va = (uint32_t)addr;
+    uint32_t key = 0;
+    pcb->group->lock.lock();
+    uint32_t* page_directory = (uint32_t*)(getCR3() & 0xFFFFF000);
+    uint32_t pde = page_directory[va >> 22];
+    if ((pde & 1) != 0) {
+        uint32_t pte = ((uint32_t*)(pde & 0xFFFFF000))[(va >> 12) & 0x3FF];
+        if ((pte & 1) != 0) {
+            key = (pte & 0xFFFFF000) | (va & 0xFFF);
+        }
+    }
+    pcb->group->lock.unlock();
+    return key;
+}
+
+// sleeps until a futex_wake on addr, unless *addr != expected. Returns 0
+// after a wake, 1 if the word had already changed
+static int32_t do_futex_wait(PCB* pcb, uint32_t* addr, uint32_t expected, const UserContext& user_context) {
+    uint32_t key = futex_key(addr);
+    if (key == 0) {
         return -1;
     }
+    if (*(volatile uint32_t*)addr != expected) {
+        // no need to leave the core
+        return 1;
+    }
+    pcb->user_context = user_context;
+    pcb->user_context.regs.eax = 0;
+    pcb->wait_lock.lock();
+    pcb->waiting_futex = key;
+    pcb->wait_lock.unlock();
+    yielding(pcb);
+    if (!Futex::wait(key, addr, expected, &pcb->resume_event)) {
+        pcb->wait_lock.lock();
+        pcb->waiting_futex = 0;
+        pcb->wait_lock.unlock();
+        return 1;
+    }
+    if (pcb->killed) {
+        // the kill may have looked before we were waiting
+        cancel_wait(pcb);
+    }
+    block();
+    return 0;
+}
 
-    Shared<FileDescriptor> file_descriptor = pcb->file_descriptor[fd];
-    if (!file_descriptor->writable || (file_descriptor->vnode != nullptr && (file_descriptor->vnode->is_dir() || file_descriptor->vnode->is_file()))) {
+static int32_t do_futex_wake(uint32_t* addr, uint32_t n) {
+    uint32_t key = futex_key(addr);
+    if (key == 0) {
         return -1;
     }
+    return Futex::wake(key, n);
+}
 
-    // write up to count bytes
-    if (file_descriptor->pipe != nullptr) {
-        // writing to pipe
-        pcb->page_directory = (uint32_t)(getCR3() & 0xFFFFF000);
-        pcb->user_context = user_context;
-        file_descriptor->pipe->put(buffer[0], [pcb]{
-            vmm_on(pcb->page_directory);
-            pcb->user_context.regs.eax = 1;
-            active_pcbs.mine() = pcb;
-            resume(&pcb->user_context);
-        });
-        interrupts.mine() = false;
-        event_loop();
-    }
-    else {
-        // write to terminal
-        for (size_t i = 0; i < count; i++) {
-            Debug::printf("%c", buffer[i]);
-            // break;
+static int32_t run_ring(PCB* pcb);
+
+// posts the completion of the submission at sq_head
+static void complete_submission(PCB* pcb, int32_t result) {
+    Ring* ring = pcb->ring;
+    RingSubmission& submission = ring->sq[ring->sq_head % Ring::ENTRIES];
+    RingCompletion& completion = ring->cq[ring->cq_tail % Ring::ENTRIES];
+    completion.user_data = submission.user_data;
+    completion.result = result;
+    ring->cq_tail = ring->cq_tail + 1;
+    ring->sq_head = ring->sq_head + 1;
+    pcb->ring_completed += 1;
+}
+
+// resume_event.prepare for a batch that had to wait: the operation that
+// blocked left its result in eax, finish it and run the rest of the batch
+static void resume_ring(PCB* pcb) {
+    complete_submission(pcb, pcb->user_context.regs.eax);
+    pcb->user_context.regs.eax = run_ring(pcb);
+}
+
+// runs submissions until there are none left or the completion queue is full,
+// returns how many completed since ring_enter. Once the process is killed the
+// remaining submissions complete with -1 without running
+static int32_t run_ring(PCB* pcb) {
+    Ring* ring = pcb->ring;
+    while (ring->sq_head != ring->sq_tail && ring->cq_tail - ring->cq_head < Ring::ENTRIES) {
+        RingSubmission& submission = ring->sq[ring->sq_head % Ring::ENTRIES];
+        uint32_t* args = submission.args;
+
+        // if the operation blocks, the batch continues when it resumes
+        pcb->resume_event.prepare = resume_ring;
+
+        int32_t result;
+        if (pcb->killed) {
+            // don't start anything new, every submission still completes
+            result = -1;
+        } else {
+            switch (submission.op) {
+                case 1002: result = do_up(pcb, args[0]); break;
+                case 1003: result = do_down(pcb, args[0], pcb->user_context); break;
+                case 1021: result = do_open(pcb, (char*)args[0]); break;
+                case 1022: result = do_close(pcb, args[0]); break;
+                case 1024: result = do_read(pcb, args[0], (char*)args[1], args[2], pcb->user_context); break;
+                case 1025: result = do_write(pcb, args[0], (char*)args[1], args[2], pcb->user_context); break;
+                case 1035: result = do_readv(pcb, args[0], (IoVec*)args[1], args[2], pcb->user_context); break;
+                case 1036: result = do_writev(pcb, args[0], (IoVec*)args[1], args[2], pcb->user_context); break;
+                case 1038: result = do_splice(pcb, args[0], args[1], args[2], pcb->user_context); break;
+                case 1039: result = do_futex_wait(pcb, (uint32_t*)args[0], args[1], pcb->user_context); break;
+                case 1040: result = do_futex_wake((uint32_t*)args[0], args[1]); break;
+                default: result = -1;
+            }
         }
 
-        return count;
+        pcb->resume_event.prepare = nullptr;
+        complete_submission(pcb, result);
     }
 
-    return -1;
+    int32_t completed = pcb->ring_completed;
+    pcb->ring_completed = 0;
+    return completed;
 }
 
 extern "C" int sysHandler(UserContext user_context) {
     auto userEsp = (uint32_t*) user_context.iFrame.esp;
     auto userEip = user_context.iFrame.eip;
+
+    // the arguments are read from the user stack
+    if ((uint32_t)userEsp < 0x80000000 || (uint32_t)userEsp >= 0xF0000000) {
+        return -1;
+    }
     
     switch(user_context.regs.eax) {
         case 0: {
@@ -179,21 +1319,18 @@ extern "C" int sysHandler(UserContext user_context) {
         } break;
         case 1:{
             // write()
-            return write(userEsp, user_context);
+            return do_write(active_pcbs.mine(), userEsp[1], (char*)userEsp[2], userEsp[3], user_context);
         } break;
         case 2: {
             // fork()
             uint32_t* parent_page_directory = (uint32_t*)(getCR3() & 0xFFFFF000);
-            uint32_t child_page_directory = PhysMem::alloc_frame();
-            
-            // share all page directory indices that are in the kernel space
-            for (uint32_t pdi = (0x00001000 >> 22); pdi < (kConfig.memSize >> 22); pdi++) {
-                uint32_t pde = parent_page_directory[pdi];
-                if ((pde & 1) == 1) {
-                    ((uint32_t*) child_page_directory)[pdi] = parent_page_directory[pdi];
-                }
-            }
-                        
+            // shares the kernel, apic and shared page tables with everyone
+            uint32_t child_page_directory = VMM::new_directory();
+
+            // the other threads can't change the mappings while we copy them
+            PCB* current_pcb = active_pcbs.mine();
+            current_pcb->group->lock.lock();
+
             // create deep copies of everything in the user space
             // loop over all page directory indices in the user space
             for (uint32_t pdi = (0x80000000 >> 22); pdi < (0xF0000000 >> 22); pdi++) {
@@ -208,7 +1345,11 @@ extern "C" int sysHandler(UserContext user_context) {
                     for (uint32_t pti = 0; pti < 1024; pti++) {
 
                         uint32_t pte = parent_page_table[pti];
-                        if ((pte & 1) == 1) {
+                        if ((pte & 1) == 1 && (pte & VMM::SHARED) != 0) {
+                            // read only program text, both map the same frame
+                            child_page_table[pti] = pte;
+                        }
+                        else if ((pte & 1) == 1) {
                             // this is a page fault, allocate a data frame for this child pt
                             child_page_table[pti] = PhysMem::alloc_frame() | 0x107;
 
@@ -224,24 +1365,24 @@ extern "C" int sysHandler(UserContext user_context) {
                     }
                 }
             }
+            VMEQueue* child_queue = current_pcb->queue->deep_copy();
+            current_pcb->group->lock.unlock();
+
 
-            // set page directory to map to the same apic tables as the parent page directory
-            ((uint32_t*)child_page_directory)[kConfig.ioAPIC >> 22] = parent_page_directory[kConfig.ioAPIC >> 22];
-            // set page directory to map to the shared page table as the parent page directory
-            ((uint32_t*)child_page_directory)[0xF0000000 >> 22] = parent_page_directory[0xF0000000 >> 22];
-            
             // create a new child pcb and add it as a child to the current pcb
             PCB* child_pcb = new PCB(child_page_directory);
-            PCB* current_pcb = active_pcbs.mine();
             current_pcb->add_child(child_pcb);
 
             // children inherit semaphores from their parents
-            for (uint32_t i = 0; i < 100; i++) {
-                child_pcb->semaphores[i] = current_pcb->semaphores[i];
-            }
+            child_pcb->semaphores = current_pcb->semaphores;
+
+            // the copied directory maps the image's shared text frames
+            child_pcb->image = current_pcb->image;
 
             // deep copy over VMEs to child
-            child_pcb->queue = current_pcb->queue->deep_copy();
+            delete child_pcb->queue;
+            child_pcb->queue = child_queue;
+            child_pcb->group->queue = child_queue;
 
             // copy over handler information to child
             child_pcb->handler_eip = current_pcb->handler_eip;
@@ -250,163 +1391,110 @@ extern "C" int sysHandler(UserContext user_context) {
 
             // copy over the file descriptor
             // child_pcb->file_descriptor = current_pcb->copy_file_descriptor();
-            for (uint32_t i = 0; i < 10; i++) {
-                child_pcb->file_descriptor[i] = current_pcb->file_descriptor[i];
-            }
+            child_pcb->file_descriptor = current_pcb->file_descriptor;
             child_pcb->cwd_node = current_pcb->cwd_node;
 
-            go([child_page_directory, child_pcb, userEsp, userEip] {
-                vmm_on(child_page_directory);
-                active_pcbs.mine() = child_pcb;
+            // the ring is part of the copied address space
+            child_pcb->ring = current_pcb->ring;
+
+            // children inherit the scheduling parameters and start out next to their parent
+            child_pcb->affinity = current_pcb->affinity;
+            child_pcb->quantum = current_pcb->quantum;
+            child_pcb->fixed_quantum = current_pcb->fixed_quantum;
+
+            go_pcb(child_pcb, [child_pcb, userEsp, userEip] {
+                dispatch(child_pcb);
                 switchToUser(userEip, (uint32_t)userEsp, 0);
             });
 
-            return 1;
+            return child_pcb->pid;
         } break;
         case 7: {
             // shutdown()
             uint32_t* page_directory = (uint32_t*)(getCR3() & 0xFFFFF000);
             VMM::free(page_directory);
-            delete active_pcbs.mine();
+            // our own hold, the PCB is gone unless a parent still has one
+            active_pcbs.mine()->release();
             Debug::shutdown();
         } break;
         case 998: {
-            // yield()
+            // yield(), accounted for before switch_processes queues us
+            yielding(active_pcbs.mine());
             switch_processes(user_context);
         } break;
         case 999: {
             // join()
             PCB* pcb = active_pcbs.mine();
             pcb->user_context = user_context;
-            if (pcb->is_empty()) {
+            PCB* child = pcb->peek_child();
+            if (child == nullptr) {
                 // this pcb has no child
                 return -1;
             }
-
-            PCB* child = pcb->peek_child();
-            if (child != nullptr) {
-                child->exit_future.get([pcb] (auto value) {
-                    pcb->remove_child();
-                    pcb->user_context.regs.eax = value;
-                    vmm_on(pcb->page_directory);
-                    active_pcbs.mine() = pcb;
-                    resume(&pcb->user_context);
-                });
-            }
-            interrupts.mine() = false;
-            event_loop();
+            pcb->resume_event.prepare = finish_join;
+            wait_for_exit(pcb, child);
         } break;
         case 1000: {
             // execl()
             char* path_name = (char*)userEsp[1];
 
-            Node* current_node = find_path_node(path_name);
-            if (current_node == nullptr || !(current_node->is_file())) {
+            if (active_pcbs.mine()->group->threads != 1) {
+                // the other threads would lose their address space
                 return -1;
             }
 
-            // find number of arguments
-            uint32_t count_args = 0;
-            while (userEsp[count_args + 2] != 0) {
-                count_args++;
+            Node* current_node = find_path_node(path_name);
+            if (current_node == nullptr || !(current_node->is_file())) {
+                return -1;
             }
 
-            // PCB* pcb = active_pcbs.mine();
-
-            // parse all the arguments
-            char** args = new char*[count_args];
-            uint32_t* string_lengths = new uint32_t[count_args];
-            uint32_t* string_pointers = new uint32_t[count_args];
-            int32_t total_length = 0;
-            for (uint32_t j = 0; j < count_args; j++) {
-                char* arg = (char*)userEsp[j + 2];
-
-                // find length of string
-                uint32_t string_length = 0;
-                while (arg[string_length] != 0) {
-                    string_length++;
-                }
-                string_length++;
-                total_length += string_length;
-
-                // arguments must lie within user space
-                if ((uint32_t)(arg) < 0x80000000 || (uint32_t)(arg) + string_length > 0xF0000000 || (uint32_t)(arg) + string_length < string_length) {
-                // if (!pcb->queue->contains_range((uint32_t)(arg), (uint32_t)(arg) + string_length)) {
-                    delete[] string_lengths;
-                    delete[] string_pointers;
-                    for (uint32_t j = 0; j < count_args; j++) {
-                        delete[] args[j];
-                    }
-                    delete[] args;
-                    return -1;
-                }
-
-                // push the arguments onto the current heap
-                args[j] = new char[string_length];
-                memcpy(args[j], arg, string_length);
-                string_lengths[j] = string_length;
-                string_pointers[j] = (uint32_t)((char*)userEsp - total_length);
+            // the argument list ends with a null pointer
+            Arguments* arguments = Arguments::copy((char**)&userEsp[2]);
+            if (arguments == nullptr) {
+                return -1;
             }
             
             int32_t e = ELF::valid_load(current_node);
             
             // check if the current_node is a valid ELF file
             if (e == -1) {
-                delete[] string_lengths;
-                delete[] string_pointers;
-                for (uint32_t j = 0; j < count_args; j++) {
-                    delete[] args[j];
-                }
-                delete[] args;
+                delete arguments;
                 return -1;
             }
 
-            uint32_t* page_directory = (uint32_t*)(getCR3() & 0xFFFFF000);
-            VMM::free(page_directory);
-            VMM::per_core_init();
+            // empty the user part and keep the directory, reloading CR3
+            // drops the old translations
             uint32_t new_page_directory = (getCR3() & 0xFFFFF000);
+            VMM::free((uint32_t*)new_page_directory);
+            active_pcbs.mine()->image.reset();
+
+            // and its vmes: one the new program doesn't replace would still
+            // allow (or, for shared text, refuse) access there. The stack
+            // stays, the arguments go on it
+            PCB* exec_pcb = active_pcbs.mine();
+            exec_pcb->group->lock.lock();
+            exec_pcb->queue->clear();
+            exec_pcb->add_stack_vme();
+            exec_pcb->ring = nullptr;
+            exec_pcb->group->lock.unlock();
+            vmm_on(new_page_directory);
             active_pcbs.mine()->page_directory = new_page_directory;
             e = ELF::load(current_node);
 
-            // push the previous arguments from the current heap onto the user stack
-            for (uint32_t j = 0; j < count_args; j++) {
-                memcpy((char*)string_pointers[j], args[j], string_lengths[j]);
-                delete[] args[j];
-            }
-            delete[] args;
-            delete[] string_lengths;
-
-            // align total length
-            total_length = -((total_length + 3) >> 2);
-
-            // add nullptr between strings and the string pointers
-            total_length--;
-            userEsp[total_length] = 0;
-
-            // add pointers to all strings
-            for (int32_t j = count_args - 1; j >= 0; j--) {
-                total_length--;
-                userEsp[total_length] = string_pointers[j];
-            }
-            delete[] string_pointers;
-
-            total_length--;
-            userEsp[total_length] = (uint32_t)userEsp + ((total_length + 1) << 2);
-            total_length--;
-            userEsp[total_length] = count_args;
-
-            userEsp += total_length;
+            // push the arguments onto the new user stack, below the old stack pointer
+            userEsp = arguments->push(userEsp);
+            delete arguments;
             
             if (interrupts.mine()) {
                 interrupts.mine() = false;
                 PCB* pcb = active_pcbs.mine();
                 pcb->user_context = user_context;
-                go([e, userEsp, pcb, new_page_directory] {
+                go_pcb(pcb, [e, userEsp, pcb, new_page_directory] {
                     pcb->page_directory = new_page_directory;
-                    vmm_on(pcb->page_directory);
-                    active_pcbs.mine() = pcb;
+                    dispatch(pcb);
                     switchToUser(e, (uint32_t)userEsp, 0);
                 });
+                in_process.mine() = false;
                 event_loop();
             }
             else {
@@ -417,47 +1505,16 @@ extern "C" int sysHandler(UserContext user_context) {
             // sem()
             PCB* pcb = active_pcbs.mine();
             uint32_t n = userEsp[1];
-            for (uint32_t i = 0; i < 100; i++) {
-                if (pcb->semaphores[i].is_null()) {
-                    pcb->semaphores[i] = Shared<Semaphore>::make(n);
-                    return i;
-                }
-            }
-
-            // 100 semaphores already created, cannot create any more.
-            return -1;
+            // -1 once the table is full
+            return pcb->semaphores.add(Shared<Semaphore>::make(n));
         } break;
         case 1002: {
             // up()
-            PCB* pcb = active_pcbs.mine();
-            uint32_t i = userEsp[1];
-            if (i < 0 || i >= 100 || pcb->semaphores[i].is_null()) {
-                // this does not point to a valid semaphore, return -1
-                return -1;
-            }
-            Shared<Semaphore> semaphore = pcb->semaphores[i];
-            semaphore->up();
-            return 0;
+            return do_up(active_pcbs.mine(), userEsp[1]);
         } break;
         case 1003: {
             // down()
-            // switch processes using semaphore
-            PCB* pcb = active_pcbs.mine();
-            uint32_t i = userEsp[1];
-            if (i < 0 || i >= 100 || pcb->semaphores[i].is_null()) {
-                // this does not point to a valid semaphore, return -1
-                return -1;
-            }
-            Shared<Semaphore> semaphore = pcb->semaphores[i];
-            pcb->user_context = user_context;
-            semaphore->down([pcb]{
-                vmm_on(pcb->page_directory);
-                pcb->user_context.regs.eax = 0;
-                active_pcbs.mine() = pcb;
-                resume(&pcb->user_context);
-            });
-            interrupts.mine() = false;
-            event_loop();
+            return do_down(active_pcbs.mine(), userEsp[1], user_context);
         } break;
         case 1004: {
             // simple_signal()
@@ -488,10 +1545,6 @@ extern "C" int sysHandler(UserContext user_context) {
                 // the desired region is not fully accessible in user mode
                 return 0;
             }
-            if (addr != 0 && pcb->queue->intersects_queue(addr, size)) {
-                // the desired region intersects with an existing mapping
-                return 0;
-            }
             
             Node* node = nullptr;
             if (fd != -1) {
@@ -500,7 +1553,7 @@ extern "C" int sysHandler(UserContext user_context) {
                     return 0;
                 }
 
-                if (fd >= 10 || pcb->file_descriptor[fd].is_null()) {
+                if (pcb->file_descriptor[fd].is_null()) {
                     // fd does not refer to an valid file descriptor
                     return 0;
                 }
@@ -511,8 +1564,16 @@ extern "C" int sysHandler(UserContext user_context) {
                 }
             }
 
-            // add the vme
+            // add the vme, checking for overlap under the same lock so two
+            // threads can't claim the same range
+            pcb->group->lock.lock();
+            if (addr != 0 && pcb->queue->intersects_queue(addr, size)) {
+                // the desired region intersects with an existing mapping
+                pcb->group->lock.unlock();
+                return 0;
+            }
             uint32_t va = pcb->queue->add_vme(new VME(addr, size));
+            pcb->group->lock.unlock();
                 
             if (fd == -1) {
                 return va;
@@ -539,11 +1600,11 @@ extern "C" int sysHandler(UserContext user_context) {
             // sem_close()
             PCB* pcb = active_pcbs.mine();
             uint32_t i = userEsp[1];
-            if (i < 0 || i >= 100 || pcb->semaphores[i].is_null()) {
+            if (pcb->semaphores[i].is_null()) {
                 // this does not point to a valid semaphore, return -1
                 return -1;
             }
-            pcb->semaphores[i] = {};
+            pcb->semaphores.clear(i);
             return 0;
         } break;
         case 1008: {
@@ -555,7 +1616,20 @@ extern "C" int sysHandler(UserContext user_context) {
                 // addr is outside the process private range
                 return -1;
             }
-            return pcb->remove_from_vmequeue(addr) ? 0 : -1;
+            Shared<ThreadGroup> group = pcb->group;
+            LockGuard g{group->lock};
+            if (!pcb->remove_from_vmequeue(addr)) {
+                return -1;
+            }
+            if (group->threads == 1) {
+                // nobody else can be using a stale translation once ours is gone
+                vmm_on(pcb->page_directory);
+                group->free_deferred();
+            }
+            if (pcb->ring != nullptr && addr >= (uint32_t)pcb->ring && addr < (uint32_t)pcb->ring + 4096) {
+                pcb->ring = nullptr;
+            }
+            return 0;
         } break;
         case 1020: {
             // chdir()
@@ -571,40 +1645,17 @@ extern "C" int sysHandler(UserContext user_context) {
         } break;
         case 1021: {
             // open()
-            char* path_name = (char*)userEsp[1];
-            Node* current_node = find_path_node(path_name);
-            if (current_node == nullptr) {
-                return -1;
-            }
-
-            PCB* pcb = active_pcbs.mine();
-            for (uint32_t i = 0; i < 10; i++) {
-                if (pcb->file_descriptor[i].is_null()) {
-                    // this is a valid location for the current node
-                    pcb->file_descriptor[i] = Shared<FileDescriptor>::make(current_node, new Atomic<uint32_t>(0));
-                    return i;
-                }
-            }
-
-            // no available file descriptors
-            return -1;
+            return do_open(active_pcbs.mine(), (char*)userEsp[1]);
         } break;
         case 1022: {
             // close()
-            uint32_t fd = userEsp[1];
-            PCB* pcb = active_pcbs.mine();
-            if (fd >= 10 || pcb->file_descriptor[fd].is_null()) {
-                return -1;
-            }
-
-            pcb->file_descriptor[fd] = {};
-            return 0;
+            return do_close(active_pcbs.mine(), userEsp[1]);
         } break;
         case 1023: {
             // len()
             uint32_t fd = userEsp[1];
             PCB* pcb = active_pcbs.mine();
-            if (fd >= 10 || pcb->file_descriptor[fd].is_null() || pcb->file_descriptor[fd]->pipe != nullptr) {
+            if (pcb->file_descriptor[fd].is_null() || !pcb->file_descriptor[fd]->pipe.is_null()) {
                 return -1;
             }
 
@@ -617,126 +1668,355 @@ extern "C" int sysHandler(UserContext user_context) {
         } break;
         case 1024: {
             // read()
+            return do_read(active_pcbs.mine(), userEsp[1], (char*)userEsp[2], userEsp[3], user_context);
+        } break;
+        case 1025: {
+            // write()
+            return do_write(active_pcbs.mine(), userEsp[1], (char*)userEsp[2], userEsp[3], user_context);
+        } break;
+        case 1026: {
+            // pipe()
+            return do_pipe(active_pcbs.mine(), (uint32_t*)userEsp[1], (uint32_t*)userEsp[2], Pipe::DEFAULT_CAPACITY);
+        } break;
+        case 1027: {
+            // kill()
+            uint32_t v = userEsp[1];
+            PCB* pcb = active_pcbs.mine();
+            PCB* child = pcb->peek_child();
+            if (child == nullptr) {
+                return -1;
+            }
+            return do_kill(child, v);
+        } break;
+        case 1028: {
+            // dup()
             uint32_t fd = userEsp[1];
-            char* buffer = (char*)(userEsp[2]);
-            size_t count = userEsp[3];
+            PCB* pcb = active_pcbs.mine();
+            if (pcb->file_descriptor[fd].is_null()) {
+                return -1;
+            }
 
-            if (count == 0) {
-                return 0;
+            // the lowest available descriptor points to the same file
+            Shared<FileDescriptor> file_descriptor = pcb->file_descriptor[fd];
+            return pcb->file_descriptor.add(file_descriptor);
+        } break;
+        case 1029: {
+            // sched_setaffinity()
+            uint32_t mask = userEsp[1] & all_cores();
+            if (mask == 0) {
+                // must be allowed to run somewhere
+                return -1;
             }
 
             PCB* pcb = active_pcbs.mine();
-
-            if (fd >= 10 || pcb->file_descriptor[fd].is_null()) {
+            pcb->affinity = mask;
+            if ((mask & (1 << SMP::me())) == 0) {
+                // we can no longer run here, move to an allowed core right away
+                user_context.regs.eax = 0;
+                SchedStats::switched(true);
+                switch_processes(user_context);
+            }
+            return 0;
+        } break;
+        case 1030: {
+            // sched_quantum()
+            PCB* pcb = active_pcbs.mine();
+            uint32_t jiffies = userEsp[1];
+            uint32_t old = pcb->quantum;
+            if (jiffies == 0) {
+                // back to adapting, starting from the default
+                pcb->fixed_quantum = false;
+                pcb->quantum = PCB::DEFAULT_QUANTUM;
+            } else {
+                pcb->fixed_quantum = true;
+                pcb->quantum = K::min(jiffies, PCB::MAX_QUANTUM);
+            }
+            return old;
+        } break;
+        case 1031: {
+            // up_n()
+            PCB* pcb = active_pcbs.mine();
+            uint32_t i = userEsp[1];
+            uint32_t n = userEsp[2];
+            if (pcb->semaphores[i].is_null()) {
+                // this does not point to a valid semaphore, return -1
                 return -1;
             }
-
-            // must be a valid user-accessible virtual address
-            if ((uint32_t)buffer < 0x80000000 || (uint32_t)buffer + count >= 0xF0000000 || (uint32_t)buffer + count < count) {
-            // if (!pcb->queue->contains_range((uint32_t)buffer, (uint32_t)buffer + count)) {
+            Shared<Semaphore> semaphore = pcb->semaphores[i];
+            semaphore->up(n);
+            return 0;
+        } break;
+        case 1032: {
+            // sched_stats()
+            uint32_t cpu = userEsp[1];
+            uint32_t out = userEsp[2];
+            if (cpu >= kConfig.totalProcs) {
                 return -1;
             }
-
-            Shared<FileDescriptor> file_descriptor = pcb->file_descriptor[fd];
-            if (!file_descriptor->readable || (file_descriptor->vnode != nullptr && file_descriptor->vnode->is_dir())) {
+            if (!copy_to_user((void*)out, &SchedStats::forCPU(cpu), sizeof(SchedStats))) {
                 return -1;
             }
-
-            // read up to count bytes 
-            if (file_descriptor->pipe != nullptr) {
-                pcb->page_directory = (uint32_t)(getCR3() & 0xFFFFF000);
-                pcb->user_context = user_context;
-                file_descriptor->pipe->get([pcb, buffer] (char value) {
-                    vmm_on(pcb->page_directory);
-                    pcb->user_context.regs.eax = 1;
-                    buffer[0] = value;
-                    active_pcbs.mine() = pcb;
-                    resume(&pcb->user_context);
-                });
-                interrupts.mine() = false;
-                event_loop();
+            return 0;
+        } break;
+        case 1033: {
+            // ring_setup()
+            PCB* pcb = active_pcbs.mine();
+            if (pcb->ring == nullptr) {
+                LockGuard g{pcb->group->lock};
+                pcb->ring = (Ring*)pcb->queue->add_vme(new VME(0, 4096));
             }
-            else {
-                Node* node = file_descriptor->vnode;
-                if (count > node->size_in_bytes() - file_descriptor->offset->get()) {
-                    count = node->size_in_bytes() - file_descriptor->offset->get();
-                }
-                int32_t n = file_descriptor->vnode->read_all(file_descriptor->offset->fetch_add(count), count, buffer);
-                // int32_t n = file_descriptor->vnode->read_all(file_descriptor->offset->fetch_add(1), 1, buffer);
-                return n == -1 ? 0 : n;
+            return (uint32_t)pcb->ring;
+        } break;
+        case 1034: {
+            // ring_enter()
+            PCB* pcb = active_pcbs.mine();
+            if (pcb->ring == nullptr) {
+                return -1;
             }
+            // saved up front, any submission might block
+            pcb->user_context = user_context;
+            pcb->ring_completed = 0;
+            return run_ring(pcb);
         } break;
-        case 1025: {
-            // write()
-            return write(userEsp, user_context);
+        case 1035: {
+            // readv()
+            return do_readv(active_pcbs.mine(), userEsp[1], (IoVec*)userEsp[2], userEsp[3], user_context);
         } break;
-        case 1026: {
-            // pipe()
-            uint32_t* write_fd = (uint32_t*)userEsp[1];
-            uint32_t* read_fd = (uint32_t*)userEsp[2]; 
+        case 1036: {
+            // writev()
+            return do_writev(active_pcbs.mine(), userEsp[1], (IoVec*)userEsp[2], userEsp[3], user_context);
+        } break;
+        case 1037: {
+            // pipe2()
+            uint32_t capacity = userEsp[3];
+            if (capacity == 0) {
+                capacity = Pipe::DEFAULT_CAPACITY;
+            }
+            if (capacity > Pipe::MAX_CAPACITY) {
+                return -1;
+            }
+            return do_pipe(active_pcbs.mine(), (uint32_t*)userEsp[1], (uint32_t*)userEsp[2], capacity);
+        } break;
+        case 1038: {
+            // splice()
+            return do_splice(active_pcbs.mine(), userEsp[1], userEsp[2], userEsp[3], user_context);
+        } break;
+        case 1039: {
+            // futex_wait()
+            return do_futex_wait(active_pcbs.mine(), (uint32_t*)userEsp[1], userEsp[2], user_context);
+        } break;
+        case 1040: {
+            // futex_wake()
+            return do_futex_wake((uint32_t*)userEsp[1], userEsp[2]);
+        } break;
+        case 1041: {
+            // spawn()
+            char* path_name = (char*)userEsp[1];
+            char** argv = (char**)userEsp[2];
 
-            PCB* pcb = active_pcbs.mine();
+            Node* node = find_path_node(path_name);
+            if (node == nullptr || !node->is_file() || ELF::valid_load(node) == (uint32_t)-1) {
+                return -1;
+            }
 
-            uint32_t count = 0;
-            for (uint32_t i = 0; i < 10; i++) {
-                if (pcb->file_descriptor[i].is_null()) {
-                    count++;
-                }
+            Arguments* arguments = Arguments::copy(argv);
+            if (arguments == nullptr) {
+                return -1;
+            }
+
+            // inherits descriptors, semaphores, cwd and scheduling like fork,
+            // but none of the parent's memory
+            PCB* current_pcb = active_pcbs.mine();
+            PCB* child_pcb = new PCB(0);
+            current_pcb->add_child(child_pcb);
+            child_pcb->semaphores = current_pcb->semaphores;
+            child_pcb->file_descriptor = current_pcb->file_descriptor;
+            child_pcb->cwd_node = current_pcb->cwd_node;
+            child_pcb->affinity = current_pcb->affinity;
+            child_pcb->quantum = current_pcb->quantum;
+            child_pcb->fixed_quantum = current_pcb->fixed_quantum;
+
+            // the child builds its own address space from the ELF file, the
+            // parent goes on right away
+            go_pcb(child_pcb, [child_pcb, node, arguments] {
+                // ELF::load and the page faults it takes work on the active pcb
+                active_pcbs.mine() = child_pcb;
+                child_pcb->page_directory = VMM::new_directory();
+                vmm_on(child_pcb->page_directory);
+                uint32_t e = ELF::load(node);
+                uint32_t* userEsp = arguments->push((uint32_t*)(0xF0000000 - 4));
+                delete arguments;
+                dispatch(child_pcb);
+                switchToUser(e, (uint32_t)userEsp, 0);
+            });
+
+            return child_pcb->pid;
+        } break;
+        case 1042: {
+            // join_any()
+            PCB* pcb = active_pcbs.mine();
+            uint32_t* status = (uint32_t*)userEsp[1];
+            if (status != nullptr && !user_range_writable(status, sizeof(uint32_t))) {
+                return -1;
             }
-            if (count < 2) {
+            if (pcb->unreaped == 0) {
+                // nothing left to wait for
                 return -1;
             }
 
-            BoundedBuffer<char>* pipe = new BoundedBuffer<char>(100);
-            *write_fd = 20;
-            *read_fd = 20;
-            for (uint32_t i = 0; i < 10; i++) {
-                if (pcb->file_descriptor[i].is_null()) {
-                    if ((*write_fd) == 20) {
-                        *write_fd = i;
-                        pcb->file_descriptor[i] = Shared<FileDescriptor>::make(false, true, pipe);
-                    }
-                    else {
-                        *read_fd = i;
-                        pcb->file_descriptor[i] = Shared<FileDescriptor>::make(true, false, pipe);
-                        return 0;
+            pcb->user_context = user_context;
+            pcb->wait_status = status;
+            PCB* child = pcb->take_exited(false);
+            if (child == nullptr) {
+                // everything the wakeup needs is in place before take_exited
+                // lets an exiting child see that we wait
+                pcb->resume_event.prepare = finish_join_any;
+                yielding(pcb);
+                child = pcb->take_exited(true);
+                if (child == nullptr) {
+                    if (pcb->killed) {
+                        // the kill may have looked before we were waiting
+                        cancel_wait(pcb);
                     }
+                    block();
                 }
+                // one exited in between after all
+                pcb->resume_event.prepare = nullptr;
             }
-
-            return -1;
+            pcb->wait_child = child;
+            finish_wait(pcb, child->exit_future.peek());
+            return pcb->user_context.regs.eax;
         } break;
-        case 1027: {
-            // kill()
-            uint32_t v = userEsp[1];
+        case 1043: {
+            // waitpid()
             PCB* pcb = active_pcbs.mine();
-            PCB* child = pcb->peek_child();
-            if (child == nullptr || child->killed || child->handled) {
+            uint32_t* status = (uint32_t*)userEsp[2];
+            if (status != nullptr && !user_range_writable(status, sizeof(uint32_t))) {
+                return -1;
+            }
+            PCB* child = pcb->find_child(userEsp[1]);
+            if (child == nullptr) {
                 return -1;
             }
 
-            child->killed = true;
-            child->killed_v = v;
+            pcb->user_context = user_context;
+            pcb->wait_child = child;
+            pcb->wait_status = status;
+            pcb->resume_event.prepare = finish_waitpid;
+            wait_for_exit(pcb, child);
+        } break;
+        case 1044: {
+            // clone()
+            uint32_t start = userEsp[1];
+            uint32_t a = userEsp[2];
+            uint32_t b = userEsp[3];
+            PCB* current_pcb = active_pcbs.mine();
+            Shared<ThreadGroup> group = current_pcb->group;
+
+            // a stack of its own, anywhere in the shared address space
+            group->lock.lock();
+            VME* stack = new VME(0, PCB::THREAD_STACK_SIZE);
+            uint32_t stack_start = current_pcb->queue->add_vme(stack);
+            if (stack_start == 0) {
+                group->lock.unlock();
+                delete stack;
+                return -1;
+            }
+            group->threads.fetch_add(1);
+            group->lock.unlock();
+
+            // shares the page directory, vmes, descriptors and semaphores,
+            // starts out with the caller's signal handler, cwd and scheduling
+            PCB* thread = PCB::new_thread(current_pcb);
+            thread->thread_stack = stack_start;
+            thread->handler_eip = current_pcb->handler_eip;
+            thread->cwd_node = current_pcb->cwd_node;
+            thread->image = current_pcb->image;
+            thread->affinity = current_pcb->affinity;
+            thread->quantum = current_pcb->quantum;
+            thread->fixed_quantum = current_pcb->fixed_quantum;
+
+            // start(a, b) with a null return address
+            uint32_t* esp = (uint32_t*)(stack_start + PCB::THREAD_STACK_SIZE) - 3;
+            esp[0] = 0;
+            esp[1] = a;
+            esp[2] = b;
+
+            go_pcb(thread, [thread, start, esp] {
+                dispatch(thread);
+                switchToUser(start, (uint32_t)esp, 0);
+            });
 
-            return 0;
+            return thread->pid;
         } break;
-        case 1028: {
-            // dup()
-            uint32_t fd = userEsp[1];
+        case 1045: {
+            // thread_join()
             PCB* pcb = active_pcbs.mine();
-            if (fd >= 10 || pcb->file_descriptor[fd].is_null()) {
+            PCB* thread = pcb->claim_thread(userEsp[1]);
+            if (thread == nullptr) {
                 return -1;
             }
 
-            for (uint32_t i = 0; i < 10; i++) {
-                if (pcb->file_descriptor[i].is_null()) {
-                    // this is a valid location to dupe
-                    pcb->file_descriptor[i] = pcb->file_descriptor[fd];
-                    return i;
+            pcb->user_context = user_context;
+            pcb->wait_child = thread;
+            pcb->resume_event.prepare = finish_thread_join;
+            wait_for_exit(pcb, thread);
+        } break;
+        case 1046: {
+            // live_counts()
+            LiveCounts counts{PCB::live.get(), gheith::heap_count, PhysMem::frames_in_use(), fs->cached_nodes()};
+            if (!copy_to_user((void*)userEsp[1], &counts, sizeof(counts))) {
+                return -1;
+            }
+            return 0;
+        } break;
+        case 1047: {
+            // kill_pid(pid, v)
+            PCB* target = PCB::find(userEsp[1]);
+            if (target == nullptr) {
+                return -1;
+            }
+            int32_t result = -1;
+            if (is_descendant(active_pcbs.mine(), target)) {
+                result = do_kill(target, userEsp[2]);
+            }
+            target->release();
+            return result;
+        } break;
+        case 1048: {
+            // getrusage(pid, out)
+            uint32_t pid = userEsp[1];
+            PCB* pcb = active_pcbs.mine();
+            ResourceUsage usage;
+            if (pid == uint32_t(-1)) {
+                usage = pcb->children_usage;
+            } else if (pid == 0 || pid == pcb->pid) {
+                usage = pcb->usage;
+            } else {
+                PCB* target = PCB::find(pid);
+                if (target == nullptr) {
+                    return -1;
                 }
+                usage = target->usage;
+                target->release();
             }
-
-            return -1;
+            if (!copy_to_user((void*)userEsp[2], &usage, sizeof(usage))) {
+                return -1;
+            }
+            return 0;
+        } break;
+        case 1049: {
+            // loadavg(cpu, out)
+            uint32_t cpu = userEsp[1];
+            if (cpu >= kConfig.totalProcs) {
+                return -1;
+            }
+            uint32_t load[3];
+            SchedStats::load(cpu, load);
+            if (!copy_to_user((void*)userEsp[2], load, sizeof(load))) {
+                return -1;
+            }
+            return 0;
         } break;
         default:
             Debug::panic("syscall %d (%x, %x, %x)\n",user_context.regs.eax, userEsp[0], userEsp[1], userEsp[2]);
@@ -746,11 +2026,33 @@ extern "C" int sysHandler(UserContext user_context) {
 }
 
 extern "C" int sysHandlerWrap(UserContext user_context) {
+    active_pcbs.mine()->usage.syscalls += 1;
     int value = sysHandler(user_context);
     switch_interrupt(user_context, value);
+    // a kill that came in during the call
+    user_context.regs.eax = value;
+    check_killed(active_pcbs.mine(), user_context);
     return value;
 }
 
+// another core killed the process running here
+extern "C" void killHandler(UserContext user_context) {
+    SMP::eoi_reg.set(0);
+    if ((user_context.iFrame.cs & 0x3) == 0) {
+        // the kernel checks before it goes back to user mode
+        return;
+    }
+    check_killed(active_pcbs.mine(), user_context);
+}
+
 void SYS::init(void) {
     IDT::trap(48,(uint32_t)sysHandler_,3);
+    IDT::interrupt(KILL_vector,(uint32_t)killHandler_);
+}
+
+// the fast path (sysenter) enters on the same kernel stack as int $48
+void SYS::per_core_init(uint32_t esp0) {
+    wrmsr(0x174, sysenterCS);                   // IA32_SYSENTER_CS
+    wrmsr(0x175, esp0);                         // IA32_SYSENTER_ESP
+    wrmsr(0x176, (uint32_t)sysenterHandler_);   // IA32_SYSENTER_EIP
 }
@@ -6,6 +6,7 @@
 class SYS {
 public:
     static void init(void);
+    static void per_core_init(uint32_t esp0);
     static void do_exit(int rc);
 };
 
@@ -13,8 +14,19 @@ extern "C" void resume(UserContext* user_context);
 
 extern void switch_processes(UserContext user_context);
 
+// resumes the pcb's user context on this core, or sends it to an allowed
+// core (and returns) if its affinity excludes this one
+extern void resume_pcb(PCB* pcb);
+
+// queues the pcb to be resumed, preferably on the core it last ran on
+extern void schedule_pcb(PCB* pcb);
+
 extern void exit(uint32_t value);
 
 extern int32_t sigreturn();
 
+// delivers a pending kill to the running pcb about to go back to
+// user_context: exits, or enters its handler. Returns if there is none
+extern void check_killed(PCB* pcb, const UserContext& user_context);
+
 #endif
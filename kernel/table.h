@@ -0,0 +1,151 @@
+#pragma once
+
+#include "stdint.h"
+#include "shared.h"
+#include "libk.h"
+#include "atomic.h"
+
+// A growable table of shared objects indexed by small integers (file
+// descriptors, semaphores).
+//
+// A bitmap of the used slots finds the lowest free index 32 slots at a
+// time. Copies of a table share its slots until one of them changes
+// (copy on write), so a fork only bumps a reference count.
+//
+// The threads of a process share one table, every operation takes its lock.
+// Lookups return a reference of their own, so an entry stays valid after a
+// concurrent change to its slot
+template <typename T>
+class Table {
+    static constexpr uint32_t INITIAL_CAPACITY = 32;
+
+    struct Slots {
+        const uint32_t capacity;    // a multiple of 32
+        Shared<T>* const entries;
+        uint32_t* const used;       // one bit per entry
+
+        explicit Slots(uint32_t capacity) : capacity(capacity), entries(new Shared<T>[capacity]),
+            used(new uint32_t[capacity / 32]) {
+            for (uint32_t i = 0; i < capacity / 32; i++) {
+                used[i] = 0;
+            }
+        }
+
+        Slots(const Slots&) = delete;
+
+        ~Slots() {
+            delete[] entries;
+            delete[] used;
+        }
+    };
+
+    mutable SpinLock lock{};
+    Shared<Slots> slots;
+    const uint32_t limit;           // the table never grows past this many slots
+
+    // gets a private copy of the slots, with room for at least "capacity"
+    void own(uint32_t capacity) {
+        if (slots.use_count() == 1 && slots->capacity >= capacity) {
+            return;
+        }
+        if (capacity < slots->capacity) {
+            capacity = slots->capacity;
+        }
+        auto copy = Shared<Slots>::make(capacity);
+        for (uint32_t i = 0; i < slots->capacity; i++) {
+            copy->entries[i] = slots->entries[i];
+        }
+        for (uint32_t i = 0; i < slots->capacity / 32; i++) {
+            copy->used[i] = slots->used[i];
+        }
+        slots = copy;
+    }
+
+    // the slots as they are now, for a copy
+    Shared<Slots> snapshot() const {
+        LockGuard g{lock};
+        return slots;
+    }
+
+    // the rest need the lock held
+    void set_locked(uint32_t i, const Shared<T>& value) {
+        if (i >= limit) {
+            return;
+        }
+        uint32_t capacity = slots->capacity;
+        while (capacity <= i) {
+            capacity *= 2;
+        }
+        own(K::min(capacity, (limit + 31) & ~31u));
+        slots->entries[i] = value;
+        if (value.is_null()) {
+            slots->used[i / 32] &= ~(1u << (i % 32));
+        } else {
+            slots->used[i / 32] |= 1u << (i % 32);
+        }
+    }
+
+    int32_t lowest_free_locked() const {
+        for (uint32_t w = 0; w < slots->capacity / 32; w++) {
+            uint32_t free = ~slots->used[w];
+            if (free != 0) {
+                uint32_t i = w * 32 + __builtin_ctz(free);
+                return (i < limit) ? i : -1;
+            }
+        }
+        // all the current slots are used, the next one means growing
+        return (slots->capacity < limit) ? (int32_t) slots->capacity : -1;
+    }
+
+public:
+    explicit Table(uint32_t limit) : slots(Shared<Slots>::make(INITIAL_CAPACITY)), limit(limit) {}
+
+    // shares the slots with "rhs" until either one changes
+    Table(const Table& rhs) : slots(rhs.snapshot()), limit(rhs.limit) {}
+
+    Table& operator=(const Table& rhs) {
+        if (this != &rhs) {
+            Shared<Slots> copy = rhs.snapshot();
+            LockGuard g{lock};
+            slots = copy;
+        }
+        return *this;
+    }
+
+    // a null Shared if "i" is not in use
+    Shared<T> operator[](uint32_t i) const {
+        LockGuard g{lock};
+        if (i >= slots->capacity) {
+            return Shared<T>{};
+        }
+        return slots->entries[i];
+    }
+
+    void set(uint32_t i, const Shared<T>& value) {
+        LockGuard g{lock};
+        set_locked(i, value);
+    }
+
+    void clear(uint32_t i) {
+        LockGuard g{lock};
+        if (i < slots->capacity && !slots->entries[i].is_null()) {
+            set_locked(i, Shared<T>{});
+        }
+    }
+
+    // the lowest index that is not in use, -1 if the table is full
+    int32_t lowest_free() const {
+        LockGuard g{lock};
+        return lowest_free_locked();
+    }
+
+    // puts "value" in the lowest free slot, returns its index or -1
+    int32_t add(const Shared<T>& value) {
+        LockGuard g{lock};
+        int32_t i = lowest_free_locked();
+        if (i >= 0) {
+            set_locked(i, value);
+        }
+        return i;
+    }
+};
@@ -0,0 +1,81 @@
+#include "user.h"
+#include "kernel.h"
+#include "pcb.h"
+#include "machine.h"
+
+// private user memory, the shared page above it is read only
+constexpr uint32_t USER_START = 0x80000000;
+constexpr uint32_t USER_END = 0xF0000000;
+
+// bytes of mapped user memory starting at "va"
+static uint32_t mapped_from(uint32_t va) {
+    if (va < USER_START || va >= USER_END) {
+        return 0;
+    }
+    PCB* pcb = active_pcbs.mine();
+    LockGuard g{pcb->group->lock};
+    return pcb->queue->mapped_from(va);
+}
+
+bool user_range_ok(const void* user, uint32_t n) {
+    uint32_t va = (uint32_t) user;
+    if (va < USER_START || va >= USER_END || USER_END - va < n) {
+        // cheap rejection before walking the vmes
+        return false;
+    }
+    PCB* pcb = active_pcbs.mine();
+    LockGuard g{pcb->group->lock};
+    return pcb->queue->contains_range(va, va + n);
+}
+
+bool user_range_writable(void* user, uint32_t n) {
+    uint32_t va = (uint32_t) user;
+    if (va < USER_START || va >= USER_END || USER_END - va < n) {
+        return false;
+    }
+    PCB* pcb = active_pcbs.mine();
+    LockGuard g{pcb->group->lock};
+    return pcb->queue->contains_range(va, va + n, true);
+}
+
+bool copy_from_user(void* dest, const void* user_src, uint32_t n) {
+    if (!user_range_ok(user_src, n)) {
+        return false;
+    }
+    memcpy(dest, user_src, n);
+    return true;
+}
+
+bool copy_to_user(void* user_dest, const void* src, uint32_t n) {
+    if (!user_range_writable(user_dest, n)) {
+        return false;
+    }
+    memcpy(user_dest, src, n);
+    return true;
+}
+
+int32_t strnlen_user(const char* user_src, uint32_t max) {
+    uint32_t mapped = mapped_from((uint32_t) user_src);
+    uint32_t limit = (mapped < max + 1) ? mapped : max + 1;
+    for (uint32_t i = 0; i < limit; i++) {
+        if (user_src[i] == 0) {
+            return i;
+        }
+    }
+    // ran into unmapped memory or past max
+    return -1;
+}
+
+int32_t strncpy_from_user(char* dest, const char* user_src, uint32_t n) {
+    if (n == 0) {
+        return -1;
+    }
+    int32_t length = strnlen_user(user_src, n - 1);
+    if (length < 0) {
+        return -1;
+    }
+    memcpy(dest, user_src, length);
+    // the source can change under us, terminate what we actually copied
+    dest[length] = 0;
+    return length;
+}
@@ -0,0 +1,29 @@
+#ifndef _USER_H_
+#define _USER_H_
+
+#include "stdint.h"
+
+// Access to the running process's memory from system calls.
+//
+// Each call checks its whole range against the process's VMEs before
+// touching it, so the copy can only take the faults that demand paging
+// resolves. Bad ranges are reported (false / -1) instead of faulting.
+
+// [user, user + n) is mapped user memory
+extern bool user_range_ok(const void* user, uint32_t n);
+
+// same, and none of it is read only (shared program text)
+extern bool user_range_writable(void* user, uint32_t n);
+
+extern bool copy_from_user(void* dest, const void* user_src, uint32_t n);
+extern bool copy_to_user(void* user_dest, const void* src, uint32_t n);
+
+// length of the string at "user_src", -1 if it runs into unmapped memory
+// or is longer than "max"
+extern int32_t strnlen_user(const char* user_src, uint32_t max);
+
+// copies the string at "user_src" and its terminator into "dest" (which
+// holds n bytes), returns its length or -1
+extern int32_t strncpy_from_user(char* dest, const char* user_src, uint32_t n);
+
+#endif
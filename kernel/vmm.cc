@@ -15,7 +15,6 @@ unsigned int volatile* fault = (unsigned int volatile*) 0xF0000800;
 namespace VMM {
 
 uint32_t the_shared_frame;
-uint32_t page_directory;
 uint32_t kernel_pt[32];
 uint32_t apic_pt;
 uint32_t shared_pt;
@@ -47,8 +46,30 @@ void global_init() {
     }
 }
 
-void per_core_init() {
-    page_directory = PhysMem::alloc_frame();
+// Directories of processes that are gone. Another core can still have one
+// in CR3 (it ran a thread of that process last and went idle), so they are
+// only ever reused as directories: their kernel part stays valid
+struct FreeDirectory {
+    FreeDirectory* next;
+    uint32_t frame;
+};
+static SpinLock free_directories_lock{};
+static FreeDirectory* free_directories = nullptr;
+
+uint32_t new_directory() {
+    free_directories_lock.lock();
+    FreeDirectory* it = free_directories;
+    if (it != nullptr) {
+        free_directories = it->next;
+    }
+    free_directories_lock.unlock();
+    if (it != nullptr) {
+        uint32_t frame = it->frame;
+        delete it;
+        return frame;
+    }
+
+    uint32_t page_directory = PhysMem::alloc_frame();
     // set page directory to map to the kernel page tables
     for (uint32_t i = 0; i < 32; i++) {
         ((uint32_t*)page_directory)[i] = kernel_pt[i] | 0x3;
@@ -57,8 +78,19 @@ void per_core_init() {
     ((uint32_t*)page_directory)[kConfig.ioAPIC >> 22] = apic_pt | 0x13;
         // set page directory to map to the shared page table
     ((uint32_t*)page_directory)[0xF0000000 >> 22] = shared_pt | 0x7;
-    
-    vmm_on(page_directory);
+    return page_directory;
+}
+
+void release_directory(uint32_t page_directory) {
+    auto it = new FreeDirectory{nullptr, page_directory};
+    free_directories_lock.lock();
+    it->next = free_directories;
+    free_directories = it;
+    free_directories_lock.unlock();
+}
+
+void per_core_init() {
+    vmm_on(new_directory());
 }
 
 void free(uint32_t* page_directory) {
@@ -71,8 +103,10 @@ void free(uint32_t* page_directory) {
             for (uint32_t pti = 0; pti < 1024; pti++) {
                 uint32_t pte = page_table[pti];
                 if ((pte & 1) == 1) {
-                    uint32_t data_frame = page_table[pti] & 0xFFFFF000;
-                    PhysMem::dealloc_frame(data_frame);
+                    if ((pte & SHARED) == 0) {
+                        uint32_t data_frame = page_table[pti] & 0xFFFFF000;
+                        PhysMem::dealloc_frame(data_frame);
+                    }
                     page_table[pti] = 0;
                 }
             }
@@ -89,8 +123,16 @@ extern "C" void vmm_pageFault(uintptr_t va_, Registers regs, uint32_t error, IFr
     if (pcb->in_handler && va_ == 0x2000) {
         // returned without explicitly calling sigreturn. returns needs to behave as if it called sigreturn
         sigreturn();
+        return;
     }
-    else if (!pcb->queue->contains_range(va_, va_)) {
+
+    // threads of the process can fault on the same table at the same time,
+    // or unmap the region under us
+    SpinLock& lock = pcb->group->lock;
+    lock.lock();
+    if (!pcb->queue->contains_range(va_, va_ + 1) || (error & 1) != 0) {
+        lock.unlock();
+        // not mapped, or a write to read only text
         // if you page fault inside the handler function, or there is no
         // registered signal handler then you should exit with code 139
         if (pcb->handler_eip == 0 || pcb->in_handler) {
@@ -130,5 +172,8 @@ extern "C" void vmm_pageFault(uintptr_t va_, Registers regs, uint32_t error, IFr
             // this is a page fault, allocate a data frame for this va
             page_table[pti] = PhysMem::alloc_frame() | 0x107;
         }
+        lock.unlock();
+        // zero filled, nothing is read from the disk
+        pcb->usage.minor_faults += 1;
     }
 }
\ No newline at end of file
@@ -5,13 +5,27 @@
 
 namespace VMM {
 
+    // A page table entry bit left to software: the frame is shared read only
+    // program text that belongs to a cached ELF image. Such entries are
+    // copied on fork and never freed with the address space
+    constexpr uint32_t SHARED = 0x200;
+
     // Called (on the initial core) to initialize data structures, etc
     extern void global_init();
 
     // Called on each core to do per-core initialization
     extern void per_core_init();
 
+    // Frees the user part of an address space: its page tables and the
+    // frames they map
     extern void free(uint32_t* page_directory);
+
+    // A page directory with only the kernel, apic and shared mappings
+    extern uint32_t new_directory();
+
+    // Gives back a directory that free() emptied, for new_directory to
+    // hand out again
+    extern void release_directory(uint32_t page_directory);
 }
 
 #endif
@@ -18,7 +18,175 @@ int checked_fork(char* file, int line) {
 
 #define FORK() checked_fork(__FILE__, __LINE__)
 
+/* queues system call "op" on the ring, tagged with user_data */
+static void ring_submit(struct ring* r, unsigned op, unsigned a, unsigned b, unsigned c, unsigned user_data) {
+    unsigned i = r->sq_tail % RING_ENTRIES;
+    r->sq[i].op = op;
+    r->sq[i].args[0] = a;
+    r->sq[i].args[1] = b;
+    r->sq[i].args[2] = c;
+    r->sq[i].user_data = user_data;
+    r->sq_tail = r->sq_tail + 1;
+}
+
+/* the same calls through the old "int $48" entry, the kernel takes both */
+extern int int48_write(int fd, void* buf, unsigned nbyte);
+extern int int48_up(unsigned s);
+extern int int48_down(unsigned s);
+extern int int48_fork(void);
+extern int int48_join(void);
+
+__asm__(
+    "int48_write:\n"
+    "    mov $1,%eax\n"
+    "    int $48\n"
+    "    ret\n"
+    "int48_up:\n"
+    "    mov $1002,%eax\n"
+    "    int $48\n"
+    "    ret\n"
+    "int48_down:\n"
+    "    mov $1003,%eax\n"
+    "    int $48\n"
+    "    ret\n"
+    "int48_fork:\n"
+    "    push %ebx\n"
+    "    push %esi\n"
+    "    push %edi\n"
+    "    push %ebp\n"
+    "    mov $2,%eax\n"
+    "    int $48\n"
+    "    pop %ebp\n"
+    "    pop %edi\n"
+    "    pop %esi\n"
+    "    pop %ebx\n"
+    "    ret\n"
+    "int48_join:\n"
+    "    mov $999,%eax\n"
+    "    int $48\n"
+    "    ret\n"
+);
+
+/* a joined child's exit path can still be finishing on another core,
+   wait until its PCB (and the directory it gives back) is gone */
+static void wait_for_pcbs(unsigned pcbs) {
+    struct live_counts counts;
+    while (1) {
+        ASSERT(live_counts(&counts) == 0);
+        if (counts.pcbs <= pcbs) {
+            return;
+        }
+        yield();
+    }
+}
+
+/* one fork + exec + open/close cycle, fully joined and reclaimed */
+static void reclaim_round(void) {
+    struct live_counts start;
+    ASSERT(live_counts(&start) == 0);
+    int fd = open("/sbin/init");
+    ASSERT(fd >= 0);
+    ASSERT(close(fd) == 0);
+    if (FORK() == 0) {
+        /* exec keeps this one open, exit has to close it */
+        ASSERT(open("/sbin/init") >= 0);
+        execl("/sbin/init", "init", "reclaim", 0);
+        exit(99);
+    }
+    ASSERT(join() == 7);
+    wait_for_pcbs(start.pcbs);
+    if (FORK() == 0) {
+        ASSERT(open("/sbin") >= 0);
+        exit(8);
+    }
+    ASSERT(join() == 8);
+    wait_for_pcbs(start.pcbs);
+}
+
+/* shared by the threads of the futex case */
+static struct lock counter_lock = LOCK_INIT;
+static unsigned counter;
+static struct usem items = USEM_INIT(0);
+static unsigned consumed;
+
+/* yields while it holds the lock, so the other threads find it taken
+   and wait for it in futex_wait */
+static int count_under_lock(void* arg) {
+    for (int i = 0; i < 100; i++) {
+        lock_acquire(&counter_lock);
+        unsigned seen = counter;
+        yield();
+        counter = seen + 1;
+        lock_release(&counter_lock);
+    }
+    return 0;
+}
+
+/* takes 50 items, waiting in futex_wait whenever there are none */
+static int consume(void* arg) {
+    for (int i = 0; i < 50; i++) {
+        usem_down(&items);
+        lock_acquire(&counter_lock);
+        consumed++;
+        lock_release(&counter_lock);
+    }
+    return (int) arg;
+}
+
+/* written by the threads of the clone case, read by main after the join */
+static unsigned clone_sum;
+
+static void clone_start(unsigned int a, unsigned int b) {
+    clone_sum = a + b;
+    exit(a * b);
+}
+
+/* fills a heap buffer main allocated */
+static int fill_buffer(void* arg) {
+    char* buffer = arg;
+    for (int i = 0; i < 1000; i++) {
+        buffer[i] = 'a' + (i % 26);
+    }
+    return 1000;
+}
+
+/* 1 if every counter in "later" is at least the one in "earlier" plus
+   the one in "added" */
+static int rusage_covers(struct rusage* later, struct rusage* earlier, struct rusage* added) {
+    return later->user_ticks >= earlier->user_ticks + added->user_ticks &&
+        later->kernel_ticks >= earlier->kernel_ticks + added->kernel_ticks &&
+        later->voluntary >= earlier->voluntary + added->voluntary &&
+        later->involuntary >= earlier->involuntary + added->involuntary &&
+        later->minor_faults >= earlier->minor_faults + added->minor_faults &&
+        later->syscalls >= earlier->syscalls + added->syscalls &&
+        later->bytes_read >= earlier->bytes_read + added->bytes_read &&
+        later->bytes_written >= earlier->bytes_written + added->bytes_written;
+}
+
+/* more threads than a run queue's lock-free ring has slots (256). Each
+   one keeps yielding, so they all stay queued until "released" */
+#define IN_LINE 300
+static volatile unsigned released;
+static unsigned next_ticket;
+static unsigned first_ticket[IN_LINE];
+
+static int wait_in_line(void* arg) {
+    first_ticket[(unsigned) arg] = __sync_fetch_and_add(&next_ticket, 1);
+    while (!released) {
+        yield();
+    }
+    return 0;
+}
+
 int main(int argc, char** argv) {
+    if (argc > 1) {
+        /* started by reclaim_round, or by the spawn case */
+        if (argv[1][0] == 's') {
+            printf("*** spawned with %d arguments: %s %s\n", argc, argv[1], argv[2]);
+        }
+        return 7;
+    }
+
     printf("*** (1) checking normal exit\n");
     if (FORK() == 0) {
         /* child */
@@ -69,6 +237,545 @@ int main(int argc, char** argv) {
     rc = sem_close(s);
     printf("*** parent4, second sem_close(%d) -> %d\n", s, rc);
 
+    printf("*** (5) sched_setaffinity\n");
+    printf("*** no core -> %d\n", sched_setaffinity(0));
+    printf("*** cores that don't exist -> %d\n", sched_setaffinity(0x80000000));
+    printf("*** core 0 -> %d\n", sched_setaffinity(1));
+    if (FORK() == 0) {
+        /* inherits the mask, still runs */
+        exit(70);
+    }
+    printf("*** pinned child -> %d\n", join());
+    printf("*** core 1 only -> %d\n", sched_setaffinity(2));
+    printf("*** every core -> %d\n", sched_setaffinity(0xFFFFFFFF));
+
+    printf("*** (6) sched_quantum\n");
+    /* the adaptive slice depends on how we ran so far */
+    sched_quantum(5);
+    printf("*** fixed at 5, now 7 -> %d\n", sched_quantum(7));
+    printf("*** 100 is capped -> %d\n", sched_quantum(100));
+    if (FORK() == 0) {
+        /* inherits the fixed slice */
+        exit(sched_quantum(0));
+    }
+    printf("*** child's slice -> %d\n", join());
+    printf("*** back to adaptive -> %d\n", sched_quantum(0));
+
+    printf("*** (7) up_n\n");
+    unsigned gate = sem(0);
+    for (int i = 0; i < 3; i++) {
+        if (FORK() == 0) {
+            down(gate);
+            exit(i + 1);
+        }
+    }
+    printf("*** up_n(3) -> %d\n", up_n(gate, 3));
+    int sum = 0;
+    for (int i = 0; i < 3; i++) {
+        sum += join();
+    }
+    printf("*** released children -> %d\n", sum);
+    printf("*** bad sem descriptor -> %d\n", up_n(1000, 1));
+    sem_close(gate);
+
+    printf("*** (8) sched_stats\n");
+    struct sched_stats stats;
+    printf("*** core 0 -> %d\n", sched_stats(0, &stats));
+    unsigned waits = 0;
+    for (int i = 0; i < 32; i++) {
+        waits += stats.queue_wait[i];
+    }
+    /* init itself was dispatched and waited in a queue on every core it used */
+    printf("*** dispatched %d, waited %d\n", stats.dispatches > 0, waits > 0);
+    printf("*** no such core -> %d\n", sched_stats(1000, &stats));
+    printf("*** kernel address -> %d\n", sched_stats(0, (struct sched_stats*) 0x1000));
+
+    printf("*** (9) ring\n");
+    printf("*** ring_enter without a ring -> %d\n", ring_enter());
+    struct ring* r = ring_setup();
+    ASSERT(r != 0);
+    ASSERT(ring_setup() == r);
+    unsigned rs = sem(0);
+    static char ring_msg[] = "*** written by the ring\n";
+    ring_submit(r, 1025, 1, (unsigned) ring_msg, sizeof(ring_msg) - 1, 11);
+    ring_submit(r, 1002, rs, 0, 0, 12);
+    /* waits, the rest of the batch runs once it is done */
+    ring_submit(r, 1003, rs, 0, 0, 13);
+    ring_submit(r, 4242, 0, 0, 0, 14);
+    printf("*** ring_enter -> %d\n", ring_enter());
+    while (r->cq_head != r->cq_tail) {
+        unsigned i = r->cq_head % RING_ENTRIES;
+        printf("*** completion %d -> %d\n", r->cq[i].user_data, r->cq[i].result);
+        r->cq_head = r->cq_head + 1;
+    }
+    sem_close(rs);
+
+    printf("*** (10) readv and writev\n");
+    struct iovec out[3] = {
+        { "*** ", 4 }, { "gathered ", 9 }, { "by writev\n", 10 }
+    };
+    int written = writev(1, out, 3);
+    printf("*** writev -> %d\n", written);
+    int elf = open("/sbin/init");
+    ASSERT(elf >= 0);
+    char magic[2][3] = { "", "" };
+    struct iovec in[3] = { { magic[0], 2 }, { 0, 0 }, { magic[1], 2 } };
+    printf("*** readv -> %d\n", readv(elf, in, 3));
+    printf("*** magic %s%s\n", magic[0] + 1, magic[1]);
+    in[1].base = (void*) 0x1000;
+    in[1].len = 4;
+    printf("*** kernel buffer -> %d\n", readv(elf, in, 3));
+    printf("*** too many buffers -> %d\n", readv(elf, in, 1025));
+    close(elf);
+
+    printf("*** (11) pipe2\n");
+    int pw;
+    int pr;
+    printf("*** capacity 65537 -> %d\n", pipe2(&pw, &pr, 65537));
+    printf("*** capacity 8 -> %d\n", pipe2(&pw, &pr, 8));
+    /* moves what fits, waits only while the pipe is full */
+    printf("*** write 20 -> %d\n", write(pw, "abcdefghijklmnopqrst", 20));
+    char piped[32];
+    int got = read(pr, piped, sizeof(piped) - 1);
+    piped[got < 0 ? 0 : got] = 0;
+    printf("*** read %d %s\n", got, piped);
+    close(pw);
+    close(pr);
+
+    printf("*** (12) splice\n");
+    int sw;
+    int sr;
+    ASSERT(pipe2(&sw, &sr, 0) == 0);
+    int sf = open("/sbin/init");
+    ASSERT(sf >= 0);
+    printf("*** file to pipe -> %d\n", splice(sf, sw, 16));
+    char head[17];
+    ASSERT(read(sr, head, 16) == 16);
+    head[4] = 0;
+    printf("*** magic %s\n", head + 1);
+    static char spliced[] = "*** spliced to the console\n";
+    ASSERT(write(sw, spliced, sizeof(spliced) - 1) == sizeof(spliced) - 1);
+    printf("*** pipe to console -> %d\n", splice(sr, 1, sizeof(spliced) - 1));
+    printf("*** pipe to pipe -> %d\n", splice(sr, sw, 1));
+    printf("*** zero bytes -> %d\n", splice(sf, sw, 0));
+    close(sf);
+    close(sw);
+    close(sr);
+
+    printf("*** (13) mixing int $48 and sysenter\n");
+    int48_write(1, "*** int $48 write\n", 18);
+    unsigned m = sem(0);
+    int48_up(m);
+    printf("*** sysenter down after int $48 up -> %d\n", down(m));
+    up(m);
+    printf("*** int $48 down after sysenter up -> %d\n", int48_down(m));
+    if (int48_fork() == 0) {
+        /* child, leaves through sysenter */
+        exit(55);
+    }
+    printf("*** int $48 join -> %d\n", int48_join());
+    if (FORK() == 0) {
+        exit(56);
+    }
+    printf("*** sysenter join -> %d\n", join());
+    sem_close(m);
+
+    printf("*** (14) reclaiming processes and descriptors\n");
+    /* the first round fills the caches (nodes, free directories) */
+    reclaim_round();
+    struct live_counts before;
+    struct live_counts after;
+    ASSERT(live_counts(&before) == 0);
+    for (int i = 0; i < 20; i++) {
+        reclaim_round();
+    }
+    /* allocations of other cores' work can still be in flight */
+    for (int tries = 0; tries < 1000; tries++) {
+        ASSERT(live_counts(&after) == 0);
+        if (after.pcbs == before.pcbs && after.heap_blocks == before.heap_blocks &&
+                after.frames == before.frames && after.nodes == before.nodes) {
+            break;
+        }
+        yield();
+    }
+    printf("*** live deltas pcbs %d heap %d frames %d nodes %d\n",
+        after.pcbs - before.pcbs, after.heap_blocks - before.heap_blocks,
+        after.frames - before.frames, after.nodes - before.nodes);
+
+    printf("*** (15) pipe2 waits\n");
+    /* 100 bytes through an 8 byte pipe: the writer waits while it is full,
+       the reader while it is empty, and the data wraps around many times */
+    int ww;
+    int wr;
+    ASSERT(pipe2(&ww, &wr, 8) == 0);
+    if (FORK() == 0) {
+        close(ww);
+        int in_order = 0;
+        char chunk[5];
+        while (in_order < 100) {
+            int n = read(wr, chunk, sizeof(chunk));
+            ASSERT(n > 0);
+            for (int i = 0; i < n; i++) {
+                if (chunk[i] != 'a' + (in_order % 26)) {
+                    exit(-in_order);
+                }
+                in_order++;
+            }
+        }
+        exit(in_order);
+    }
+    close(wr);
+    char alphabet[100];
+    for (int i = 0; i < 100; i++) {
+        alphabet[i] = 'a' + (i % 26);
+    }
+    int sent = 0;
+    while (sent < 100) {
+        int n = write(ww, alphabet + sent, 100 - sent);
+        ASSERT(n > 0);
+        sent += n;
+    }
+    printf("*** wrote %d\n", sent);
+    printf("*** read back in order -> %d\n", join());
+    close(ww);
+
+    printf("*** (16) concurrent console writers\n");
+    /* four children on different cores write the same line ten times,
+       one write per line: any interleaving gives the same lines, unless
+       two writes get mixed up */
+    unsigned go = sem(0);
+    for (int i = 0; i < 4; i++) {
+        if (FORK() == 0) {
+            static char line[] = "*** one write, one whole line 0123456789abcdefghijklmnopqrstuvwxyz\n";
+            down(go);
+            for (int j = 0; j < 10; j++) {
+                ASSERT(write(1, line, sizeof(line) - 1) == sizeof(line) - 1);
+            }
+            exit(1);
+        }
+    }
+    up_n(go, 4);
+    int writers = 0;
+    for (int i = 0; i < 4; i++) {
+        writers += join();
+    }
+    printf("*** writers done -> %d\n", writers);
+    sem_close(go);
+
+    printf("*** (17) futex lock and semaphore\n");
+    unsigned word = 5;
+    printf("*** futex_wait on a changed word -> %d\n", futex_wait(&word, 6));
+    printf("*** futex_wait on a kernel address -> %d\n", futex_wait((unsigned*) 0x1000, 0));
+    printf("*** futex_wake without waiters -> %d\n", futex_wake(&word, 1));
+    int counters[4];
+    for (int i = 0; i < 4; i++) {
+        counters[i] = thread_create(count_under_lock, 0);
+        ASSERT(counters[i] > 0);
+    }
+    int joined = 0;
+    for (int i = 0; i < 4; i++) {
+        joined += thread_join(counters[i]) == 0;
+    }
+    printf("*** %d threads counted to %d\n", joined, counter);
+    int consumers[2];
+    for (int i = 0; i < 2; i++) {
+        consumers[i] = thread_create(consume, (void*) (i + 1));
+        ASSERT(consumers[i] > 0);
+    }
+    for (int i = 0; i < 100; i++) {
+        if (i % 10 == 0) {
+            /* let the consumers run dry and wait */
+            yield();
+        }
+        usem_up(&items);
+    }
+    int ids = 0;
+    for (int i = 0; i < 2; i++) {
+        ids += thread_join(consumers[i]);
+    }
+    printf("*** consumers %d took %d, %d left\n", ids, consumed, items.count);
+
+    printf("*** (18) waitpid and join_any\n");
+    int first = FORK();
+    if (first == 0) {
+        exit(11);
+    }
+    int second = FORK();
+    if (second == 0) {
+        exit(12);
+    }
+    int status = 0;
+    int waited = waitpid(second, &status);
+    printf("*** waitpid(second) -> %d, status %d\n", waited == second, status);
+    printf("*** waitpid(second) again -> %d\n", waitpid(second, &status));
+    printf("*** waitpid(unknown pid) -> %d\n", waitpid(first + 1000, &status));
+    printf("*** join collects the first -> %d\n", join());
+    int any[3];
+    for (int i = 0; i < 3; i++) {
+        any[i] = FORK();
+        if (any[i] == 0) {
+            exit(20 + i);
+        }
+    }
+    int found = 0;
+    int statuses = 0;
+    for (int i = 0; i < 3; i++) {
+        int pid = join_any(&status);
+        found += pid == any[0] || pid == any[1] || pid == any[2];
+        statuses += status;
+    }
+    printf("*** join_any found %d, statuses %d\n", found, statuses);
+    printf("*** join_any without children -> %d\n", join_any(&status));
+
+    printf("*** (19) clone and thread_join\n");
+    int tid = clone(clone_start, 6, 7);
+    ASSERT(tid > 0);
+    printf("*** thread_join -> %d\n", thread_join(tid));
+    printf("*** the thread wrote %d\n", clone_sum);
+    printf("*** thread_join again -> %d\n", thread_join(tid));
+    int process = FORK();
+    if (process == 0) {
+        exit(0);
+    }
+    /* a child process is not one of our threads */
+    printf("*** thread_join of a process -> %d\n", thread_join(process));
+    join();
+    char* filled = malloc(1000);
+    ASSERT(filled != 0);
+    memset(filled, '.', 1000);
+    tid = thread_create(fill_buffer, filled);
+    ASSERT(tid > 0);
+    int join_result = thread_join(tid);
+    int same = 1;
+    for (int i = 0; i < 1000; i++) {
+        same = same && filled[i] == 'a' + (i % 26);
+    }
+    printf("*** filled %d bytes, as seen by main %d\n", join_result, same);
+    free(filled);
+
+    printf("*** (20) spawn\n");
+    char* spawn_argv[] = { "init", "spawned", "again", 0 };
+    int spawned = spawn("/sbin/init", spawn_argv);
+    ASSERT(spawned > 0);
+    /* it prints its arguments before it exits */
+    printf("*** spawned init exits with %d\n", join());
+    printf("*** no such file -> %d\n", spawn("/sbin/nothing", spawn_argv));
+    printf("*** a directory -> %d\n", spawn("/sbin", spawn_argv));
+    printf("*** not an ELF file -> %d\n", spawn("/sbin/init.c", spawn_argv));
+
+    printf("*** (21) racing first loads\n");
+    /* nothing ran /sbin/shared yet, both children parse it at once */
+    unsigned racing = sem(0);
+    for (int i = 0; i < 2; i++) {
+        if (FORK() == 0) {
+            down(racing);
+            execl("/sbin/shared", "shared", 0);
+            exit(-1);
+        }
+    }
+    up_n(racing, 2);
+    int loaded = 0;
+    for (int i = 0; i < 2; i++) {
+        loaded += join() == 15;
+    }
+    printf("*** copies that ran -> %d\n", loaded);
+    sem_close(racing);
+
+    printf("*** (22) shared program text\n");
+    unsigned both = sem(0);
+    ASSERT(both < 10);
+    char gate_arg[2] = { '0' + both, 0 };
+    char* copy_argv[] = { "shared", gate_arg, 0 };
+    int copy1 = spawn("/sbin/shared", copy_argv);
+    int copy2 = spawn("/sbin/shared", copy_argv);
+    ASSERT(copy1 > 0 && copy2 > 0);
+    /* both run at the same time, on the same text */
+    up_n(both, 2);
+    int copy_status = 0;
+    ASSERT(waitpid(copy1, &copy_status) == copy1);
+    printf("*** first copy -> %d\n", copy_status);
+    ASSERT(waitpid(copy2, &copy_status) == copy2);
+    printf("*** second copy -> %d\n", copy_status);
+    /* exec drops init's one writable segment before it maps the shared text */
+    if (FORK() == 0) {
+        execl("/sbin/shared", "shared", 0);
+        exit(-1);
+    }
+    printf("*** exec'd copy -> %d\n", join());
+    sem_close(both);
+
+    printf("*** (23) kill_pid\n");
+    int kw;
+    int kr;
+    ASSERT(pipe2(&kw, &kr, 0) == 0);
+    int pid_w;
+    int pid_r;
+    ASSERT(pipe2(&pid_w, &pid_r, 0) == 0);
+    int middle = FORK();
+    if (middle == 0) {
+        /* the reader is init's grandchild, still its descendant */
+        int reader = FORK();
+        if (reader == 0) {
+            char c;
+            read(kr, &c, 1);
+            exit(-1);
+        }
+        write(pid_w, &reader, sizeof(reader));
+        int reader_status = 0;
+        waitpid(reader, &reader_status);
+        exit(reader_status);
+    }
+    int reader = 0;
+    ASSERT(read(pid_r, &reader, sizeof(reader)) == sizeof(reader));
+    /* nothing ever gets written, let it block in the read */
+    for (int i = 0; i < 10; i++) {
+        yield();
+    }
+    printf("*** kill a grandchild blocked in a pipe read -> %d\n", kill_pid(reader, 31));
+    printf("*** kill it again -> %d\n", kill_pid(reader, 31));
+    int kill_status = 0;
+    ASSERT(waitpid(middle, &kill_status) == middle);
+    printf("*** its parent saw %d\n", kill_status);
+    close(kw);
+    close(kr);
+    close(pid_w);
+    close(pid_r);
+    /* the spinner has core 1 to itself, only the IPI stops it */
+    ASSERT(sched_setaffinity(1) == 0);
+    unsigned spinning = sem(0);
+    int spinner = FORK();
+    if (spinner == 0) {
+        sched_setaffinity(2);
+        up(spinning);
+        while (1) {
+        }
+    }
+    down(spinning);
+    if (FORK() == 0) {
+        /* a sibling is not a descendant */
+        exit(kill_pid(spinner, 33));
+    }
+    printf("*** a sibling kills the spinner -> %d\n", join());
+    printf("*** kill the spinner on core 1 -> %d\n", kill_pid(spinner, 32));
+    ASSERT(waitpid(spinner, &kill_status) == spinner);
+    printf("*** spinner exits with %d\n", kill_status);
+    printf("*** kill a reclaimed pid -> %d\n", kill_pid(spinner, 32));
+    sem_close(spinning);
+    ASSERT(sched_setaffinity(0xFFFFFFFF) == 0);
+
+    printf("*** (24) waiting on both ends\n");
+    /* the child echoes what it reads: it waits on an empty pipe, we wait
+       on a full one and then on the empty way back */
+    int to_w;
+    int to_r;
+    int back_w;
+    int back_r;
+    ASSERT(pipe2(&to_w, &to_r, 4) == 0);
+    ASSERT(pipe2(&back_w, &back_r, 0) == 0);
+    if (FORK() == 0) {
+        char echo[64];
+        int echoed = 0;
+        while (echoed < 64) {
+            int n = read(to_r, echo + echoed, sizeof(echo) - echoed);
+            ASSERT(n > 0);
+            echoed += n;
+        }
+        ASSERT(write(back_w, echo, sizeof(echo)) == sizeof(echo));
+        exit(echoed);
+    }
+    /* long enough for the child to block in its first read */
+    for (int i = 0; i < 10; i++) {
+        yield();
+    }
+    int pushed = 0;
+    while (pushed < 64) {
+        int n = write(to_w, alphabet + pushed, 64 - pushed);
+        ASSERT(n > 0);
+        pushed += n;
+    }
+    printf("*** wrote %d through a 4 byte pipe\n", pushed);
+    char returned[64];
+    int came_back = 0;
+    while (came_back < 64) {
+        int n = read(back_r, returned + came_back, sizeof(returned) - came_back);
+        ASSERT(n > 0);
+        came_back += n;
+    }
+    for (int i = 0; i < 64; i++) {
+        if (returned[i] != alphabet[i]) {
+            came_back = -1;
+        }
+    }
+    printf("*** echoed back in order -> %d\n", came_back);
+    printf("*** the echo read %d\n", join());
+    close(to_w);
+    close(to_r);
+    close(back_w);
+    close(back_r);
+
+    printf("*** (25) getrusage and loadavg\n");
+    static struct rusage nothing;
+    struct rusage mine_before;
+    struct rusage mine_after;
+    struct rusage children_before;
+    struct rusage children_after;
+    struct rusage live_child;
+    ASSERT(getrusage(0, &mine_before) == 0);
+    ASSERT(getrusage(-1, &children_before) == 0);
+    unsigned counted = sem(0);
+    unsigned leave = sem(0);
+    int counting = FORK();
+    if (counting == 0) {
+        for (int i = 0; i < 20; i++) {
+            yield();
+        }
+        up(counted);
+        down(leave);
+        exit(0);
+    }
+    down(counted);
+    ASSERT(getrusage(counting, &live_child) == 0);
+    printf("*** a live child's yields -> %d\n", live_child.voluntary >= 20 && live_child.syscalls >= 21);
+    up(leave);
+    ASSERT(join() == 0);
+    ASSERT(getrusage(-1, &children_after) == 0);
+    printf("*** the joined child is included -> %d\n", rusage_covers(&children_after, &children_before, &live_child));
+    ASSERT(getrusage(0, &mine_after) == 0);
+    printf("*** our own counters never go back -> %d\n", rusage_covers(&mine_after, &mine_before, &nothing));
+    printf("*** no such pid -> %d\n", getrusage(1000000, &mine_after));
+    printf("*** kernel address -> %d\n", getrusage(0, (struct rusage*)4096));
+    unsigned load[3];
+    int loads = 0;
+    for (unsigned cpu = 0; cpu < 4; cpu++) {
+        loads += loadavg(cpu, load) == 0;
+    }
+    printf("*** loadavg on 4 cores -> %d\n", loads);
+    printf("*** loadavg on a missing core -> %d\n", loadavg(64, load));
+    sem_close(counted);
+    sem_close(leave);
+
+    printf("*** (26) more runnable threads than the ring holds\n");
+    /* all on core 0, whose queue spills into its overflow; the other cores
+       only look at it, and the threads first run in the order we queued them */
+    ASSERT(sched_setaffinity(1) == 0);
+    static int in_line[IN_LINE];
+    for (int i = 0; i < IN_LINE; i++) {
+        in_line[i] = thread_create(wait_in_line, (void*) i);
+        ASSERT(in_line[i] > 0);
+    }
+    released = 1;
+    int left_line = 0;
+    for (int i = 0; i < IN_LINE; i++) {
+        left_line += thread_join(in_line[i]) == 0;
+    }
+    int in_turn = 0;
+    for (int i = 0; i < IN_LINE; i++) {
+        in_turn += first_ticket[i] == (unsigned) i;
+    }
+    printf("*** joined %d\n", left_line);
+    printf("*** first ran in turn %d\n", in_turn);
+    ASSERT(sched_setaffinity(0xFFFFFFFF) == 0);
+
     shutdown();
     return 0;
 }
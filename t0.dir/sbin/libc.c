@@ -17,3 +17,53 @@ int puts(const char* p) {
     
     return count+1;
 }
+
+void lock_acquire(struct lock* l) {
+    unsigned int c = 0;
+    if (__atomic_compare_exchange_n(&l->state, &c, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return;
+    }
+    /* mark it contended so the holder knows to wake someone */
+    if (c != 2) {
+        c = __atomic_exchange_n(&l->state, 2, __ATOMIC_ACQUIRE);
+    }
+    while (c != 0) {
+        futex_wait(&l->state, 2);
+        c = __atomic_exchange_n(&l->state, 2, __ATOMIC_ACQUIRE);
+    }
+}
+
+void lock_release(struct lock* l) {
+    if (__atomic_exchange_n(&l->state, 0, __ATOMIC_RELEASE) == 2) {
+        futex_wake(&l->state, 1);
+    }
+}
+
+void usem_down(struct usem* s) {
+    while (1) {
+        unsigned int c = __atomic_load_n(&s->count, __ATOMIC_RELAXED);
+        while (c > 0) {
+            if (__atomic_compare_exchange_n(&s->count, &c, c - 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+                return;
+            }
+        }
+        __atomic_add_fetch(&s->waiters, 1, __ATOMIC_SEQ_CST);
+        futex_wait(&s->count, 0);
+        __atomic_sub_fetch(&s->waiters, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+void usem_up(struct usem* s) {
+    __atomic_add_fetch(&s->count, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&s->waiters, __ATOMIC_SEQ_CST) > 0) {
+        futex_wake(&s->count, 1);
+    }
+}
+
+static void thread_main(unsigned int fn, unsigned int arg) {
+    exit(((int (*)(void*))fn)((void*)arg));
+}
+
+int thread_create(int (*fn)(void*), void* arg) {
+    return clone(thread_main, (unsigned int)fn, (unsigned int)arg);
+}
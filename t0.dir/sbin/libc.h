@@ -20,6 +20,32 @@ extern int putchar(int c);
 extern int puts(const char *p);
 
 extern int printf(const char* fmt, ...);
+
+/* A lock and a counting semaphore that live in user memory and only
+   enter the kernel (futex_wait / futex_wake) when they are contended */
+
+struct lock {
+    unsigned int state;     /* 0 free, 1 held, 2 held and maybe waited on */
+};
+
+#define LOCK_INIT { 0 }
+
+extern void lock_acquire(struct lock* l);
+extern void lock_release(struct lock* l);
+
+struct usem {
+    unsigned int count;
+    unsigned int waiters;   /* callers between seeing count == 0 and waking */
+};
+
+#define USEM_INIT(n) { (n), 0 }
+
+extern void usem_down(struct usem* s);
+extern void usem_up(struct usem* s);
+
+/* Runs fn(arg) in a new thread, whose exit code is what fn returns.
+   Returns the thread id for thread_join, or -1 */
+extern int thread_create(int (*fn)(void*), void* arg);
 extern int isdigit(int c);
 
 #endif
@@ -0,0 +1,42 @@
+#include "libc.h"
+
+/* Linked with its text and data in separate segments (see the Makefile),
+   so every copy that runs maps the same read only text. Exits with one
+   bit per check that passed, 15 when they all did */
+
+/* every copy has its own */
+int runs = 0;
+static char data_buffer[4];
+
+int main(int argc, char** argv) {
+    if (argc > 1) {
+        /* argv[1] is a semaphore that lets all the copies go at once */
+        down(argv[1][0] - '0');
+    }
+
+    int passed = 0;
+    runs++;
+    if (runs == 1) {
+        passed |= 1;
+    }
+
+    int fd = open("/sbin/shared");
+    if (read(fd, data_buffer, 4) == 4 && data_buffer[1] == 'E') {
+        passed |= 2;
+    }
+    /* the kernel doesn't write into the text for us */
+    if (read(fd, (char*) main, 4) == -1) {
+        passed |= 4;
+    }
+    close(fd);
+
+    /* and neither can we, in a forked copy either */
+    if (fork() == 0) {
+        *(volatile char*) main = 0;
+        exit(0);
+    }
+    if (join() == 139) {
+        passed |= 8;
+    }
+    return passed;
+}
@@ -21,12 +21,116 @@ extern int fork();
 extern int execl(const char *pathname, const char *arg, ...
                        /* (char  *) NULL */);
 
+/* spawn */
+extern int spawn(const char* path, char* const argv[]);
+
 /* shutdown */
 extern void shutdown(void);
 
+/* yield: let other processes run first */
+extern void yield(void);
+
 /* join */
 extern int join(void);
 
+/* sched_setaffinity: the cores (bit i -> core i) this process may run on */
+extern int sched_setaffinity(unsigned mask);
+
+/* sched_quantum: fixes the time slice at n jiffies (0 adapts again), returns the old one */
+extern int sched_quantum(unsigned jiffies);
+
+/* up_n: n ups on semaphore s, waking the waiters it releases at once */
+extern int up_n(unsigned int s, unsigned int n);
+
+/* sched_stats: scheduler statistics of a core, histograms in TSC cycles,
+   bucket i counts samples in [2^i, 2^(i+1)) */
+struct sched_stats {
+    unsigned queue_wait[32];
+    unsigned run_length[32];
+    unsigned dispatches;
+    unsigned voluntary;
+    unsigned involuntary;
+};
+extern int sched_stats(unsigned cpu, struct sched_stats* out);
+
+/* ring_setup / ring_enter: a batch of system calls in shared memory, the
+   layout of kernel/ring.h. Slot i is at i % RING_ENTRIES */
+#define RING_ENTRIES 64
+struct ring {
+    volatile unsigned sq_head, sq_tail;
+    volatile unsigned cq_head, cq_tail;
+    struct { unsigned op, args[3], user_data; } sq[RING_ENTRIES];
+    struct { unsigned user_data; int result; } cq[RING_ENTRIES];
+};
+extern struct ring* ring_setup(void);
+extern int ring_enter(void);
+
+/* open: the lowest free descriptor for the file or directory at path, -1 on error */
+extern int open(const char* path);
+
+/* close */
+extern int close(int fd);
+
+/* readv / writev: read into / write from several buffers in one call */
+struct iovec {
+    void* base;
+    unsigned len;
+};
+extern int readv(int fd, struct iovec* iov, unsigned iovcnt);
+extern int writev(int fd, struct iovec* iov, unsigned iovcnt);
+
+/* read */
+extern ssize_t read(int fd, void* buf, size_t count);
+
+/* pipe2: a pipe of 'capacity' bytes (0 means 4096, at most 65536) */
+extern int pipe2(int* write_fd, int* read_fd, unsigned capacity);
+
+/* splice: moves bytes file -> pipe, file -> console or pipe -> console
+   without a user buffer */
+extern int splice(int fd_in, int fd_out, unsigned count);
+
+/* join_any */
+extern int join_any(int* status);
+
+/* waitpid */
+extern int waitpid(int pid, int* status);
+
+/* clone: a new thread in this process runs start(a, b) on a stack of its own */
+extern int clone(void (*start)(unsigned int a, unsigned int b), unsigned int a, unsigned int b);
+
+/* thread_join */
+extern int thread_join(int tid);
+
+/* live_counts: kernel objects still alive, the same before and after a
+   batch of processes that have all been joined */
+struct live_counts {
+    unsigned pcbs;
+    unsigned heap_blocks;
+    unsigned frames;
+    unsigned nodes;
+};
+extern int live_counts(struct live_counts* out);
+
+/* kill_pid: signal #2 to one of our threads or a descendant, by pid */
+extern int kill_pid(int pid, unsigned v);
+
+/* getrusage: what a process or thread has used so far, pid 0 is the caller
+   and -1 the children it joined */
+struct rusage {
+    unsigned user_ticks;
+    unsigned kernel_ticks;
+    unsigned voluntary;
+    unsigned involuntary;
+    unsigned minor_faults;
+    unsigned syscalls;
+    unsigned long long bytes_read;
+    unsigned long long bytes_written;
+};
+extern int getrusage(int pid, struct rusage* out);
+
+/* loadavg: runnable processes on a core over 1, 5 and 15 minutes, 11 fraction bits */
+extern int loadavg(unsigned cpu, unsigned out[3]);
+
 /* sem */
 extern int sem(unsigned int);
 
@@ -36,6 +140,12 @@ extern int up(unsigned int);
 /* down */
 extern int down(unsigned int);
 
+/* futex_wait */
+extern int futex_wait(unsigned int* addr, unsigned int expected);
+
+/* futex_wake */
+extern int futex_wake(unsigned int* addr, unsigned int n);
+
 /* sem_close */
 extern int sem_close(int s);
 